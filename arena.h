@@ -0,0 +1,245 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/**
+ * Node allocation policies for BinarySearchTree and its subclasses.
+ *
+ * A policy hands out raw blocks for tree nodes and takes them back.
+ * The tree constructs and destroys the nodes itself. Every policy provides:
+ *
+ *   void* allocate(std::size_t bytes);  // storage for one node
+ *   void deallocate(void* block);       // give back one node's storage
+ *   void release();                     // called by clear() once every node is gone
+ *   static const bool bulkRelease;      // release() frees every block at once
+ *   static const bool threadSafe;       // allocate/deallocate may race
+ */
+
+/**
+ * The default policy: one operator new/delete per node.
+ */
+class HeapArena
+{
+public:
+    void* allocate(std::size_t bytes);
+    void deallocate(void* block);
+    void release();
+
+    static const bool bulkRelease = false;
+    static const bool threadSafe = true;
+};
+
+/**
+ * Allocates a node's storage from the global heap.
+ */
+inline void* HeapArena::allocate(std::size_t bytes)
+{
+    return ::operator new(bytes);
+}
+
+/**
+ * Returns a node's storage to the global heap.
+ */
+inline void HeapArena::deallocate(void* block)
+{
+    ::operator delete(block);
+}
+
+/**
+ * Nothing to do, every node was already deallocated on its own.
+ */
+inline void HeapArena::release()
+{
+
+}
+
+/**
+ * A policy that carves nodes out of large contiguous slabs.
+ * Removed nodes go onto an intrusive free list and are reused by the
+ * next insert. release() hands back whole slabs, so a tree of n nodes
+ * is dropped in O(n / nodes-per-slab).
+ *
+ * The block size is fixed by the first allocation, so one arena serves
+ * one node type. If HugePages is set the slabs are rounded up to 2MB and
+ * backed by huge pages where the OS allows it (MAP_HUGETLB, or else
+ * transparent huge pages through madvise).
+ */
+template<std::size_t SlabBytes = 64 * 1024, bool HugePages = false>
+class SlabArena
+{
+public:
+    SlabArena();
+    ~SlabArena();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* block);
+    void release();
+
+    static const bool bulkRelease = true;
+    static const bool threadSafe = false;
+
+private:
+    SlabArena(const SlabArena&);
+    SlabArena& operator=(const SlabArena&);
+
+    void addSlab();
+    static void* mapSlab(std::size_t bytes);
+    static void unmapSlab(void* slab, std::size_t bytes);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    std::vector<void*> slabs_;
+    FreeBlock* freeList_;
+    char* bump_;      // first never-used block in the newest slab
+    char* slabEnd_;
+    std::size_t blockSize_;
+    std::size_t slabSize_;
+};
+
+static const std::size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+/*
+  -------------------------------------------
+  Begin implementations for the SlabArena class.
+  -------------------------------------------
+*/
+
+template<std::size_t SlabBytes, bool HugePages>
+SlabArena<SlabBytes, HugePages>::SlabArena() :
+    freeList_(NULL),
+    bump_(NULL),
+    slabEnd_(NULL),
+    blockSize_(0),
+    slabSize_(0)
+{
+
+}
+
+template<std::size_t SlabBytes, bool HugePages>
+SlabArena<SlabBytes, HugePages>::~SlabArena()
+{
+    release();
+}
+
+/**
+ * Hands out one block, preferring a previously freed one.
+ * Throws std::bad_alloc if asked for more than the block size fixed by
+ * the first call.
+ */
+template<std::size_t SlabBytes, bool HugePages>
+void* SlabArena<SlabBytes, HugePages>::allocate(std::size_t bytes)
+{
+    if(blockSize_ == 0){
+        // Round up so every block stays suitably aligned for any node type
+        const std::size_t align = alignof(std::max_align_t);
+        std::size_t size = bytes < sizeof(FreeBlock) ? sizeof(FreeBlock) : bytes;
+        blockSize_ = (size + align - 1) / align * align;
+    } else if(bytes > blockSize_) {
+        throw std::bad_alloc();
+    }
+
+    if(freeList_ != NULL){
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        return block;
+    }
+    if(bump_ == NULL || bump_ + blockSize_ > slabEnd_)
+        addSlab();
+    void* block = bump_;
+    bump_ += blockSize_;
+    return block;
+}
+
+/**
+ * Pushes a block onto the free list for reuse. Slabs are only returned
+ * to the OS by release().
+ */
+template<std::size_t SlabBytes, bool HugePages>
+void SlabArena<SlabBytes, HugePages>::deallocate(void* block)
+{
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+/**
+ * Frees every slab at once. Any node still living in them is gone.
+ */
+template<std::size_t SlabBytes, bool HugePages>
+void SlabArena<SlabBytes, HugePages>::release()
+{
+    for(std::size_t i = 0; i < slabs_.size(); ++i)
+        unmapSlab(slabs_[i], slabSize_);
+    slabs_.clear();
+    freeList_ = NULL;
+    bump_ = NULL;
+    slabEnd_ = NULL;
+}
+
+template<std::size_t SlabBytes, bool HugePages>
+void SlabArena<SlabBytes, HugePages>::addSlab()
+{
+    if(slabSize_ == 0){
+        slabSize_ = SlabBytes < blockSize_ ? blockSize_ : SlabBytes;
+        if(HugePages)
+            slabSize_ = (slabSize_ + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    }
+    void* slab = mapSlab(slabSize_);
+    slabs_.push_back(slab);
+    bump_ = static_cast<char*>(slab);
+    slabEnd_ = bump_ + slabSize_;
+}
+
+template<std::size_t SlabBytes, bool HugePages>
+void* SlabArena<SlabBytes, HugePages>::mapSlab(std::size_t bytes)
+{
+#if defined(__linux__)
+    if(HugePages){
+        void* slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if(slab == MAP_FAILED){ // No reserved huge pages, fall back to transparent ones
+            slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(slab == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            madvise(slab, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        return slab;
+    }
+#endif
+    return ::operator new(bytes);
+}
+
+template<std::size_t SlabBytes, bool HugePages>
+void SlabArena<SlabBytes, HugePages>::unmapSlab(void* slab, std::size_t bytes)
+{
+#if defined(__linux__)
+    if(HugePages){
+        munmap(slab, bytes);
+        return;
+    }
+#endif
+    (void)bytes;
+    ::operator delete(slab);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the SlabArena class.
+  -----------------------------------------
+*/
+
+#endif
@@ -6,10 +6,18 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
+#include <future>
+#include <vector>
 #include "bst.h"
 
 struct KeyError { };
 
+// Smallest subtree that assignSorted() will hand to another thread.
+static const std::size_t AVL_PARALLEL_BUILD_MIN = 1 << 15;
+// Smallest height (about a thousand nodes) at which the set operations fork.
+static const int AVL_PARALLEL_SET_HEIGHT = 14;
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
@@ -21,7 +29,9 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename... Args>
+    AVLNode(AVLNode<Key, Value>* parent, Args&&... args);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
@@ -29,11 +39,17 @@ public:
     void updateBalance(int8_t diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide the Node versions
+    // rather than override them; see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
+
+    // Hooks for subclasses that keep a count of their subtree, see
+    // CountedAVLNode. A plain AVLNode keeps none, so these do nothing.
+    static const bool counted = false;
+    void recount();
+    void swapCount(AVLNode<Key, Value>* other);
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -55,6 +71,17 @@ AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Va
 
 }
 
+/**
+* A constructor that forwards args on to build the item in place.
+*/
+template<class Key, class Value>
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(AVLNode<Key, Value> *parent, Args&&... args) :
+    Node<Key, Value>(parent, std::forward<Args>(args)...), balance_(0)
+{
+
+}
+
 /**
 * A destructor which does nothing.
 */
@@ -92,7 +119,7 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A redefined function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
@@ -119,6 +146,24 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
     return static_cast<AVLNode<Key, Value>*>(this->right_);
 }
 
+/**
+* Nothing to recount in a plain AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::recount()
+{
+
+}
+
+/**
+* Nothing to swap in a plain AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::swapCount(AVLNode<Key, Value>*)
+{
+
+}
+
 
 /*
   -----------------------------------------------
@@ -126,102 +171,386 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
   -----------------------------------------------
 */
 
+/**
+* An AVLNode that also stores the number of nodes in its subtree, which
+* lets an AVLTree answer select/rank queries in O(log n). Use it through
+* OrderStatisticTree below.
+*/
+template <typename Key, typename Value>
+class CountedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    CountedAVLNode(const Key& key, const Value& value, CountedAVLNode<Key, Value>* parent);
+    template<typename... Args>
+    CountedAVLNode(CountedAVLNode<Key, Value>* parent, Args&&... args);
+
+    // Redefined for the same reasons as in AVLNode.
+    CountedAVLNode<Key, Value>* getParent() const;
+    CountedAVLNode<Key, Value>* getLeft() const;
+    CountedAVLNode<Key, Value>* getRight() const;
+
+    std::size_t getCount() const;
+    static std::size_t countOf(const CountedAVLNode<Key, Value>* node);
+
+    static const bool counted = true;
+    void recount();
+    void swapCount(CountedAVLNode<Key, Value>* other);
+
+protected:
+    std::size_t count_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the CountedAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+CountedAVLNode<Key, Value>::CountedAVLNode(const Key& key, const Value& value, CountedAVLNode<Key, Value> *parent) :
+    AVLNode<Key, Value>(key, value, parent), count_(1)
+{
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+}
+
+template<class Key, class Value>
+template<typename... Args>
+CountedAVLNode<Key, Value>::CountedAVLNode(CountedAVLNode<Key, Value> *parent, Args&&... args) :
+    AVLNode<Key, Value>(parent, std::forward<Args>(args)...), count_(1)
+{
+
+}
+
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getParent() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->parent_);
+}
+
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getLeft() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getRight() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->right_);
+}
+
+/**
+* A getter for the number of nodes in this subtree, this one included.
+*/
+template<class Key, class Value>
+std::size_t CountedAVLNode<Key, Value>::getCount() const
+{
+    return count_;
+}
+
+/**
+* Same as getCount, but 0 for a NULL subtree.
+*/
+template<class Key, class Value>
+std::size_t CountedAVLNode<Key, Value>::countOf(const CountedAVLNode<Key, Value>* node)
+{
+    return node == NULL ? 0 : node->count_;
+}
+
+/**
+* Recomputes the count from the children, which must already be correct.
+*/
+template<class Key, class Value>
+void CountedAVLNode<Key, Value>::recount()
+{
+    count_ = 1 + countOf(getLeft()) + countOf(getRight());
+}
+
+/**
+* Counts belong to positions in the tree, so they move with nodeSwap.
+*/
+template<class Key, class Value>
+void CountedAVLNode<Key, Value>::swapCount(CountedAVLNode<Key, Value>* other)
+{
+    std::swap(count_, other->count_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the CountedAVLNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A self-balancing AVL tree. Arena is the node allocation policy, see arena.h.
+* NodeType is AVLNode or a subclass of it that keeps extra per-node data,
+* such as CountedAVLNode for order statistics. Compare orders the keys, as
+* in BinarySearchTree.
+*/
+template <class Key, class Value, class Arena = HeapArena, class NodeType = AVLNode<Key, Value>, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Arena, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    typedef typename BinarySearchTree<Key, Value, Arena, Compare>::iterator iterator;
+
+    AVLTree();
+    explicit AVLTree(const Compare& compare);
+    virtual ~AVLTree();
+    using BinarySearchTree<Key, Value, Arena, Compare>::insert; // Copies, by way of insertCopy
+    virtual std::pair<iterator, bool> insert (std::pair<const Key, Value> &&new_item); // TODO
+    virtual iterator insert (iterator hint, std::pair<const Key, Value> &&new_item);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    virtual void clear();
+    virtual bool isBalanced() const;
+    template<typename ForwardIterator>
+    void assignSorted(ForwardIterator first, ForwardIterator last, unsigned threads = 1);
+    template<typename InputIterator>
+    void buildFrom(InputIterator first, InputIterator last, unsigned threads = 1);
+
+    // Moving nodes between trees, O(log n). Arena must be stateless (HeapArena).
+    void split(const Key& key, AVLTree& left, AVLTree& right);
+    void join(AVLTree& left, const std::pair<const Key, Value>& pivot, AVLTree& right);
+    void join(AVLTree& left, AVLTree& right);
+
+    // Set algebra that consumes other, O(m log(n/m + 1)) for sizes m <= n.
+    template<typename Combine>
+    void unionWith(AVLTree& other, Combine combine, unsigned threads = 1);
+    template<typename Combine>
+    void intersectWith(AVLTree& other, Combine combine, unsigned threads = 1);
+    void differenceWith(AVLTree& other, unsigned threads = 1);
+
+    // O(1) with a counted NodeType, otherwise an O(n) walk.
+    std::size_t size() const;
+    // Order statistics, O(log n). These need a counted NodeType (see OrderStatisticTree).
+    iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t rank(iterator it) const;
+    iterator jump(iterator it, std::ptrdiff_t n) const;
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    NodeType* getRoot() const;
+    std::size_t countItems(std::true_type) const;
+    std::size_t countItems(std::false_type) const;
+    void nodeSwap( NodeType* n1, NodeType* n2);
+    virtual void removeNode(Node<Key, Value>* node);  // TODO
+    virtual std::pair<iterator, bool> insertCopy(const std::pair<const Key, Value>& new_item);
+    virtual iterator insertCopy(iterator hint, const std::pair<const Key, Value>& new_item);
 
     // Add helper functions here
-    void insertFix( AVLNode<Key,Value>* p, AVLNode<Key,Value>* n );
-    void removeFix( AVLNode<Key,Value>* n, int diff );
-    void rotate( AVLNode<Key, Value>* n, int heavy );
-    static AVLNode<Key, Value>* predecessor(AVLNode<Key, Value>* current);
+    std::pair<iterator, bool> insertBalance(std::pair<NodeType*, bool> result);
+    static void recountPath(NodeType* n);
+    void insertFix( NodeType* p, NodeType* n );
+    void removeFix( NodeType* n, int diff );
+    void rotate( NodeType* n, int heavy );
+    static void rotate( NodeType* n, int heavy, Node<Key, Value>*& root );
+    static NodeType* predecessor(NodeType* current);
+    static int heightOf(NodeType* root);
+    static void expose(NodeType* root, int height, NodeType*& left, int& leftHeight, NodeType*& right, int& rightHeight);
+    static NodeType* joinNodes(NodeType* left, int leftHeight, NodeType* pivot, NodeType* right, int rightHeight, int& height);
+    static NodeType* joinNodes(NodeType* left, int leftHeight, NodeType* right, int rightHeight, int& height);
+    static bool joinFix(NodeType* n, int diff, Node<Key, Value>*& root);
+    void splitNodes(NodeType* root, int height, const Key& key, NodeType*& left, int& leftHeight,
+                    NodeType*& match, NodeType*& right, int& rightHeight) const;
+    void splitNodes(NodeType* root, int height, const Key& key, NodeType*& left, int& leftHeight,
+                    NodeType*& match, NodeType*& right, int& rightHeight, bool& bounded) const;
+    static NodeType* splitLast(NodeType* root, int height, NodeType*& last, int& restHeight);
+    template<typename Combine>
+    NodeType* unionNodes(NodeType* a, int aHeight, NodeType* b, int bHeight, Combine& combine, unsigned threads, int& height);
+    template<typename Combine>
+    NodeType* intersectNodes(NodeType* a, int aHeight, NodeType* b, int bHeight, Combine& combine, unsigned threads, int& height);
+    NodeType* differenceNodes(NodeType* a, int aHeight, NodeType* b, int bHeight, unsigned threads, int& height);
+    template<typename Recurse>
+    void recurseBoth(Recurse recurse, NodeType* l1, int lh1, NodeType* l2, int lh2, NodeType* r1, int rh1,
+                     NodeType* r2, int rh2, unsigned threads,
+                     NodeType*& left, int& leftHeight, NodeType*& right, int& rightHeight);
+    template<typename ForwardIterator>
+    NodeType* buildSorted(ForwardIterator& it, std::size_t n, int& height,
+                                     unsigned threads, std::forward_iterator_tag);
+    template<typename RandomIterator>
+    NodeType* buildSorted(RandomIterator& it, std::size_t n, int& height,
+                                     unsigned threads, std::random_access_iterator_tag);
 
 };
 
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+AVLTree<Key, Value, Arena, NodeType, Compare>::AVLTree()
+{
+
+}
+
+/*
+ * Constructs an empty tree that orders its keys with compare.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+AVLTree<Key, Value, Arena, NodeType, Compare>::AVLTree(const Compare& compare) :
+    BinarySearchTree<Key, Value, Arena, Compare>(compare)
+{
+
+}
+
+/*
+ * Frees the nodes here, while the tree still knows they are AVLNodes.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+AVLTree<Key, Value, Arena, NodeType, Compare>::~AVLTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::clear()
+{
+    this->template clearNodes<NodeType>();
+}
+
+/*
+ * O(1): insertFix, removeFix and join keep every balance factor within
+ * [-1, 1], so the root's is the only one left to look at. shape() still
+ * walks the whole tree, for when the invariant itself is in question.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+bool AVLTree<Key, Value, Arena, NodeType, Compare>::isBalanced() const
+{
+    NodeType* root = getRoot();
+    return root == NULL || (root->getBalance() >= -1 && root->getBalance() <= 1);
+}
+
+/*
+ * Every node in an AVLTree is an AVLNode, so the root can be cast statically.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::getRoot() const
+{
+    return static_cast<NodeType*>(AVLTree<Key, Value, Arena, NodeType, Compare>::root_);
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::insert (std::pair<const Key, Value> &&new_item)
 {
     // TODO
-    if(AVLTree<Key, Value>::root_ == NULL)
-        AVLTree<Key, Value>::root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-    else{
-        //If root is not NULL
-        AVLNode<Key, Value> *temp = dynamic_cast<AVLNode<Key, Value>*>(AVLTree<Key, Value>::root_);
-        bool overwrite = false;
-        bool isLeftChild = false;
-        while(true){
-            if(new_item.first < temp->getKey()){
-                if(temp->getLeft() == NULL){ //If we are going off the end, make note of direction and stop
-                    isLeftChild = true;
-                    break;
-                }
-                temp = temp->getLeft();
-            } else if(new_item.first > temp->getKey()) {
-                if(temp->getRight() == NULL){ //If we are going off the end, make note of direction and stop
-                    isLeftChild = false;
-                    break;
-                }
-                temp = temp->getRight();
-            } else{ //If key exists already
-                overwrite = true;
-                break;
-            }
-        }
-    
-        // Modify values as instructed
-        if(overwrite)
-            temp->setValue(new_item.second);
-        else{
-            if(isLeftChild)
-                temp->setLeft(new AVLNode<Key, Value>(new_item.first, new_item.second, temp));
-            else
-                temp->setRight(new AVLNode<Key, Value>(new_item.first, new_item.second, temp));
-            // AVL Tree balancing
-            if(temp->getBalance() != 0)
-                temp->setBalance(0);
-            else{
-                if(isLeftChild){
-                    temp->updateBalance(-1);
-                    insertFix(temp, temp->getLeft());
-                } else {
-                    temp->updateBalance(1);
-                    insertFix(temp, temp->getRight());
-                }
-            }
+    return insertBalance(this->template insertItem<NodeType>(std::move(new_item)));
+}
+
+/*
+ * See the hinted BinarySearchTree::insert. Rebalancing starts from the new
+ * leaf as usual, so in-order appends cost amortized O(1) comparisons.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator
+AVLTree<Key, Value, Arena, NodeType, Compare>::insert (iterator hint, std::pair<const Key, Value> &&new_item)
+{
+    return insertBalance(this->template insertItem<NodeType>(hint, std::move(new_item))).first;
+}
+
+/*
+ * The copying inserts, see BinarySearchTree::insertCopy.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::insertCopy (const std::pair<const Key, Value> &new_item)
+{
+    return insertBalance(this->template insertItem<NodeType>(this->copiedItem(new_item)));
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator
+AVLTree<Key, Value, Arena, NodeType, Compare>::insertCopy (iterator hint, const std::pair<const Key, Value> &new_item)
+{
+    return insertBalance(this->template insertItem<NodeType>(hint, this->copiedItem(new_item))).first;
+}
+
+/*
+ * See BinarySearchTree::emplace. Redefined so the tree gets AVLNodes and stays balanced.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::emplace(Args&&... args)
+{
+    return insertBalance(this->template emplaceItem<NodeType>(std::forward<Args>(args)...));
+}
+
+/*
+ * See BinarySearchTree::try_emplace. Redefined for the same reasons as above.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return insertBalance(this->template tryEmplaceItem<NodeType>(key, std::forward<Args>(args)...));
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return insertBalance(this->template tryEmplaceItem<NodeType>(std::move(key), std::forward<Args>(args)...));
+}
+
+/*
+ * Rebalances after one of the insert cores, if it added a new leaf, and
+ * turns its result into the iterator/bool pair the public functions return.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::pair<typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator, bool>
+AVLTree<Key, Value, Arena, NodeType, Compare>::insertBalance(std::pair<NodeType*, bool> result)
+{
+    NodeType* n = result.first;
+    NodeType* p = n->getParent();
+    if(NodeType::counted && result.second)
+        recountPath(p);
+    if(result.second && p != NULL){
+        // AVL Tree balancing
+        if(p->getBalance() != 0)
+            p->setBalance(0);
+        else if(p->getLeft() == n){
+            p->updateBalance(-1);
+            insertFix(p, n);
+        } else {
+            p->updateBalance(1);
+            insertFix(p, n);
         }
     }
+    return std::make_pair(this->makeIterator(n), result.second);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix( AVLNode<Key,Value>* p, AVLNode<Key,Value>* n )
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::insertFix( NodeType* p, NodeType* n )
 {
-    if(p == NULL || p->getParent() == NULL)
-        return;
-    AVLNode<Key, Value>* g = p->getParent();
-    int mult = 1; // 1 means right, -1 means left
-    if(g->getLeft() == p)
-        mult = -1;
-    g->updateBalance(mult); // Update g's value to new accurate value
-    if(g->getBalance() == 0)
-        return;
-    else if(g->getBalance() == 1*mult)
-        insertFix(g, p); // Recurse
-    else if(g->getBalance() == 2*mult) {
+    while(p != NULL && p->getParent() != NULL) {
+        BST_STAT(STAT_INSERT_FIX_STEPS, 1);
+        NodeType* g = p->getParent();
+        int mult = 1; // 1 means right, -1 means left
+        if(g->getLeft() == p)
+            mult = -1;
+        g->updateBalance(mult); // Update g's value to new accurate value
+        if(g->getBalance() == 0)
+            return;
+        if(g->getBalance() == 1*mult) { // g got taller, go up a level
+            n = p;
+            p = g;
+            continue;
+        }
+        // g->getBalance() == 2*mult
         if((mult == 1 && p->getRight() == n) || (mult == -1 && p->getLeft() == n)){ // Zig-zig
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
             rotate(g, mult);
             g->setBalance(0);
             p->setBalance(0);
         } else { // Zig-zag
+            BST_STAT(STAT_DOUBLE_ROTATIONS, 1);
             rotate(p, -1*mult);
             rotate(g, mult);
             if(n->getBalance() == mult){
@@ -238,15 +567,22 @@ void AVLTree<Key, Value>::insertFix( AVLNode<Key,Value>* p, AVLNode<Key,Value>*
                 n->setBalance(0);
             }
         }
+        return;
     }
 }
 
 // If heavy = -1 then it's rotate right, if heavy = 1 then it's rotate left
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotate( AVLNode<Key, Value>* n, int heavy ) {
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::rotate( NodeType* n, int heavy ) {
+    rotate(n, heavy, AVLTree<Key, Value, Arena, NodeType, Compare>::root_);
+}
+
+// Same, for subtrees that are not (yet) hung off root_: root is updated instead
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::rotate( NodeType* n, int heavy, Node<Key, Value>*& root ) {
     if(heavy == -1) { // Rotate right, 6 changes necessary
-        AVLNode<Key, Value>* p = n->getParent();
-        AVLNode<Key, Value>* c = n->getLeft();
+        NodeType* p = n->getParent();
+        NodeType* c = n->getLeft();
         
         if(p != NULL){
             if(p->getLeft() == n) //Check which child n is then set that child of p to c
@@ -254,17 +590,19 @@ void AVLTree<Key, Value>::rotate( AVLNode<Key, Value>* n, int heavy ) {
             else
                 p->setRight(c);
         } else
-            AVLTree<Key, Value>::root_ = c; // If we are rotating root we need to set root_ to c
+            root = c; // If we are rotating root we need to set root to c
         c->setParent(p);
         n->setParent(c);
         n->setLeft(c->getRight());
         c->setRight(n);
         if(n->getLeft() != NULL) // Check if child exists before setting parent
             n->getLeft()->setParent(n);
+        n->recount(); // n is now below c
+        c->recount();
 
     } else {
-        AVLNode<Key, Value>* p = n->getParent();
-        AVLNode<Key, Value>* c = n->getRight();
+        NodeType* p = n->getParent();
+        NodeType* c = n->getRight();
         
         if(p != NULL){
             if(p->getLeft() == n) // Check which child n is then set that child of p to c
@@ -272,163 +610,997 @@ void AVLTree<Key, Value>::rotate( AVLNode<Key, Value>* n, int heavy ) {
             else
                 p->setRight(c);
         } else
-            AVLTree<Key, Value>::root_ = c; // If we are rotating root we need to set root_ to c
+            root = c; // If we are rotating root we need to set root to c
         c->setParent(p);
         n->setParent(c);
         n->setRight(c->getLeft());
         c->setLeft(n);
         if(n->getRight() != NULL) // Check if child exists before setting parent
             n->getRight()->setParent(n);
+        n->recount(); // n is now below c
+        c->recount();
     }
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
+ * should swap with the predecessor and then remove. Every remove
+ * overload in BinarySearchTree finds the node and ends up here.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::removeNode(Node<Key, Value>* node)
 {
     // TODO
-    if(AVLTree<Key, Value>::root_ == NULL){
-        return;
+    NodeType *temp = static_cast<NodeType*>(node);
+    if(temp->getLeft() != NULL && temp->getRight() != NULL) // If has both children
+        nodeSwap(temp, predecessor(temp));
+    NodeType* p = temp->getParent();
+    int diff = 0;
+    if(p != NULL){
+        bool isLeftChild = p->getLeft() == temp;
+        if(isLeftChild)
+            diff = 1;
+        else
+            diff = -1;
     }
-    //If root is not NULL
-    AVLNode<Key, Value> *temp = dynamic_cast<AVLNode<Key, Value>*>(AVLTree<Key, Value>::root_);
-    while(temp != NULL){
-        if(key > temp->getKey()) // If key is greater than current node, go right
-            temp = temp->getRight();
-        else if (key < temp->getKey())
-            temp = temp->getLeft(); // If key is less than current node, go left
-        else { // We found the node
-            if(temp->getLeft() != NULL && temp->getRight() != NULL) // If has both children
-                nodeSwap(temp, predecessor(temp));
-            AVLNode<Key, Value>* p = temp->getParent();
-            int diff = 0;
-            if(p != NULL){
-                bool isLeftChild = p->getLeft() == temp;
-                if(isLeftChild)
-                    diff = 1;
-                else
-                    diff = -1;
-            }
-            // Update pointers, from BST
-            if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
-                if(p == NULL) // If no parent, set root to NULL, then delete
-                    AVLTree<Key, Value>::root_ = NULL;
-                else if(p->getRight() == temp) //If is right child, set parent's right child to NULL
-                    p->setRight(NULL);
-                else // Else if is left child, set parent's left child to NULL
-                    p->setLeft(NULL);
-            } else if(temp->getLeft() == NULL && temp->getRight() != NULL){ // Has right child only, promote child then delete
-                if(p != NULL){ // If has parent
-                    if(p->getRight() == temp) //If temp is right child, set parent's right child to temp's right
-                        p->setRight(temp->getRight());
-                    else // Else if temp is left child, set parent's left child to temp's right
-                        p->setLeft(temp->getRight());
-                    temp->getRight()->setParent(p); //Set child's parent to temp's parent
-                } else { // If no parent, set root to child, then delete
-                    AVLTree<Key, Value>::root_ = temp->getRight();
-                    AVLTree<Key, Value>::root_->setParent(NULL);
-                }
-            } else if(temp->getLeft() != NULL && temp->getRight() == NULL){ // Has left child only, promote child then delete
-                if(p != NULL){ // If has parent
-                    if(p->getRight() == temp) //If temp is right child, set parent's right child to temp's left
-                        p->setRight(temp->getLeft());
-                    else // Else if temp is left child, set parent's left child to temp's left
-                        p->setLeft(temp->getLeft());
-                    temp->getLeft()->setParent(p); //Set child's parent to temp's parent
-                } else { // If no parent, set root to child, then delete
-                    AVLTree<Key, Value>::root_ = temp->getLeft();
-                    AVLTree<Key, Value>::root_->setParent(NULL);
-                }
-            }
-            delete temp;
-            removeFix(p, diff);
-            break;
+    // Update pointers, from BST
+    if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
+        if(p == NULL) // If no parent, set root to NULL, then delete
+            AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = NULL;
+        else if(p->getRight() == temp) //If is right child, set parent's right child to NULL
+            p->setRight(NULL);
+        else // Else if is left child, set parent's left child to NULL
+            p->setLeft(NULL);
+    } else if(temp->getLeft() == NULL && temp->getRight() != NULL){ // Has right child only, promote child then delete
+        if(p != NULL){ // If has parent
+            if(p->getRight() == temp) //If temp is right child, set parent's right child to temp's right
+                p->setRight(temp->getRight());
+            else // Else if temp is left child, set parent's left child to temp's right
+                p->setLeft(temp->getRight());
+            temp->getRight()->setParent(p); //Set child's parent to temp's parent
+        } else { // If no parent, set root to child, then delete
+            AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = temp->getRight();
+            AVLTree<Key, Value, Arena, NodeType, Compare>::root_->setParent(NULL);
+        }
+    } else if(temp->getLeft() != NULL && temp->getRight() == NULL){ // Has left child only, promote child then delete
+        if(p != NULL){ // If has parent
+            if(p->getRight() == temp) //If temp is right child, set parent's right child to temp's left
+                p->setRight(temp->getLeft());
+            else // Else if temp is left child, set parent's left child to temp's left
+                p->setLeft(temp->getLeft());
+            temp->getLeft()->setParent(p); //Set child's parent to temp's parent
+        } else { // If no parent, set root to child, then delete
+            AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = temp->getLeft();
+            AVLTree<Key, Value, Arena, NodeType, Compare>::root_->setParent(NULL);
         }
     }
+    this->detachNode(temp);
+    this->destroyNode(temp);
+    if(NodeType::counted)
+        recountPath(p);
+    removeFix(p, diff);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix( AVLNode<Key,Value>* n, int diff )
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::removeFix( NodeType* n, int diff )
 {
-    if(n == NULL)
-        return;
-    AVLNode<Key, Value>* p = n->getParent();
-    int ndiff = -1;
-    if(p != NULL && p->getLeft() == n)
-        ndiff = 1;
-    if(n->getBalance() + diff == 2*diff) { // Case 1
-        AVLNode<Key, Value>* c;
-        if(diff == -1)
-            c = n->getLeft();
-        else
-            c = n->getRight();
-        if(c->getBalance() == 1*diff){ // Case 1a, zig zig
-            rotate(n, 1*diff);
-            n->setBalance(0);
-            c->setBalance(0);
-            removeFix(p, ndiff);
-        } else if(c->getBalance() == 0) { // Case 1b, zig zig
-            rotate(n, 1*diff);
-            n->setBalance(1*diff);
-            c->setBalance(-1*diff);
-        } else if(c->getBalance() == -1*diff) { // Case 1c, zig zag
-            AVLNode<Key, Value>* g;
-            if (diff == -1)
-                g = c->getRight();
+    // Each pass either stops or moves up to p, whose subtree got shorter on side ndiff
+    while(n != NULL) {
+        BST_STAT(STAT_REMOVE_FIX_STEPS, 1);
+        NodeType* p = n->getParent();
+        int ndiff = -1;
+        if(p != NULL && p->getLeft() == n)
+            ndiff = 1;
+        if(n->getBalance() + diff == 2*diff) { // Case 1
+            NodeType* c;
+            if(diff == -1)
+                c = n->getLeft();
             else
-                g = c->getLeft();
-            int gBal = g->getBalance();
-            rotate(c, -1*diff);
-            rotate(n, 1*diff);
-            if(gBal == -1*diff){
-                n->setBalance(0);
-                c->setBalance(1*diff);
-                g->setBalance(0);
-            } else if(gBal == 0) {
+                c = n->getRight();
+            if(c->getBalance() == 1*diff){ // Case 1a, zig zig
+                BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+                rotate(n, 1*diff);
                 n->setBalance(0);
                 c->setBalance(0);
-                g->setBalance(0);
-            } else {// gBal == 1*diff
-                n->setBalance(-1*diff);
-                c->setBalance(0);
-                g->setBalance(0);
+            } else if(c->getBalance() == 0) { // Case 1b, zig zig
+                BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+                rotate(n, 1*diff);
+                n->setBalance(1*diff);
+                c->setBalance(-1*diff);
+                return;
+            } else { // Case 1c, zig zag
+                BST_STAT(STAT_DOUBLE_ROTATIONS, 1);
+                NodeType* g;
+                if (diff == -1)
+                    g = c->getRight();
+                else
+                    g = c->getLeft();
+                int gBal = g->getBalance();
+                rotate(c, -1*diff);
+                rotate(n, 1*diff);
+                if(gBal == -1*diff){
+                    n->setBalance(0);
+                    c->setBalance(1*diff);
+                    g->setBalance(0);
+                } else if(gBal == 0) {
+                    n->setBalance(0);
+                    c->setBalance(0);
+                    g->setBalance(0);
+                } else {// gBal == 1*diff
+                    n->setBalance(-1*diff);
+                    c->setBalance(0);
+                    g->setBalance(0);
+                }
             }
-            removeFix(p, ndiff);
+        } else if(n->getBalance() + diff == 1*diff) { // Case 2
+            n->setBalance(1*diff);
+            return;
+        } else { // Case 3, balance + diff == 0
+            n->setBalance(0);
         }
-    } else if(n->getBalance() + diff == 1*diff) { // Case 2
-        n->setBalance(1*diff);
-    } else { // Case 3, balance + diff == 0
-        n->setBalance(0);
-        removeFix(p, ndiff);
+        n = p;
+        diff = ndiff;
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::nodeSwap( NodeType* n1, NodeType* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Arena, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    n1->swapCount(n2);
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>*
-AVLTree<Key, Value>::predecessor(AVLNode<Key, Value>* current)
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType*
+AVLTree<Key, Value, Arena, NodeType, Compare>::predecessor(NodeType* current)
 {
     if(current->getLeft() != NULL){ // Need to find the largest node in left subtree
-        AVLNode<Key, Value> *temp = current->getLeft();
+        NodeType *temp = current->getLeft();
         while(temp->getRight() != NULL) { temp = temp->getRight(); }
         return temp;
     }
-    //If no left child need to check if this is a right or left child
-    if(current->getParent()->getLeft() == current) // If left child, then return NULL
+    //If no left child, walk up until we come from a right child; that parent is next smallest
+    NodeType *child = current;
+    NodeType *parent = current->getParent();
+    while(parent != NULL && parent->getLeft() == child){
+        child = parent;
+        parent = parent->getParent();
+    }
+    return parent; // NULL if current was the smallest
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), which
+ * must be sorted by strictly increasing key. The tree is built perfectly
+ * balanced in a single linear pass, with no rotations. Given random access
+ * iterators, a thread-safe arena and threads > 1, large subtrees are built
+ * concurrently.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename ForwardIterator>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::assignSorted(ForwardIterator first, ForwardIterator last, unsigned threads)
+{
+    clear();
+    std::size_t n = std::distance(first, last);
+    int height;
+    if(!Arena::threadSafe)
+        threads = 1;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = buildSorted(first, n, height, threads,
+        typename std::iterator_traits<ForwardIterator>::iterator_category());
+    this->rethread();
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), in
+ * any order. Where a key repeats, the last one given wins, as it would
+ * with a run of insert() calls. The items are copied out, sorted and
+ * handed to assignSorted, all on up to threads threads.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename InputIterator>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::buildFrom(InputIterator first, InputIterator last, unsigned threads)
+{
+    std::vector<std::pair<Key, Value> > items = this->sortedItems(first, last, threads);
+    assignSorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()), threads);
+}
+
+/*
+ * Moves every item with a key less than key into left and the rest into
+ * right, leaving this tree empty. Whatever left and right held before is
+ * cleared. No node is copied or reallocated: the tree is cut along the
+ * search path for key and the pieces are joined back up, which costs
+ * O(log n) in total.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::split(const Key& key, AVLTree& left, AVLTree& right)
+{
+    static_assert(std::is_empty<Arena>::value, "split() moves nodes between trees, so their arena must be stateless");
+    NodeType* root = getRoot();
+    int height = heightOf(root);
+    Node<Key, Value>* largest = AVLTree<Key, Value, Arena, NodeType, Compare>::largest_;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = NULL;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = NULL;
+    left.clear();
+    right.clear();
+
+    NodeType *l, *match, *r;
+    int leftHeight, rightHeight;
+    splitNodes(root, height, key, l, leftHeight, match, r, rightHeight);
+    if(match != NULL){ // key itself goes right, as its smallest item
+        int matchHeight;
+        r = joinNodes(NULL, 0, match, r, rightHeight, matchHeight);
+    }
+    left.root_ = l;
+    left.largest_ = this->getLargestNode(l);
+    right.root_ = r;
+    right.largest_ = r != NULL ? largest : NULL;
+    this->linkThreads(left.largest_, NULL);
+    this->linkThreads(NULL, this->getSmallestNode(r));
+}
+
+/*
+ * Replaces the contents of this tree with left, then pivot, then right,
+ * leaving left and right empty. Every key in left must be less than
+ * pivot's and every key in right greater. Only pivot gets a new node.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::join(AVLTree& left, const std::pair<const Key, Value>& pivot, AVLTree& right)
+{
+    static_assert(std::is_empty<Arena>::value, "join() moves nodes between trees, so their arena must be stateless");
+    NodeType* l = left.getRoot();
+    NodeType* r = right.getRoot();
+    Node<Key, Value>* leftLargest = left.largest_;
+    Node<Key, Value>* rightLargest = right.largest_;
+    NodeType* k = this->createNode(static_cast<NodeType*>(NULL), pivot);
+    left.root_ = NULL;
+    left.largest_ = NULL;
+    right.root_ = NULL;
+    right.largest_ = NULL;
+    clear();
+
+    this->linkThreads(leftLargest, k);
+    this->linkThreads(k, this->getSmallestNode(r));
+    int height;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = joinNodes(l, heightOf(l), k, r, heightOf(r), height);
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = r != NULL ? rightLargest : k;
+}
+
+/*
+ * Replaces the contents of this tree with left followed by right, leaving
+ * both empty. Every key in left must be less than every key in right.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::join(AVLTree& left, AVLTree& right)
+{
+    static_assert(std::is_empty<Arena>::value, "join() moves nodes between trees, so their arena must be stateless");
+    NodeType* l = left.getRoot();
+    NodeType* r = right.getRoot();
+    Node<Key, Value>* leftLargest = left.largest_;
+    Node<Key, Value>* rightLargest = right.largest_;
+    left.root_ = NULL;
+    left.largest_ = NULL;
+    right.root_ = NULL;
+    right.largest_ = NULL;
+    clear();
+
+    this->linkThreads(leftLargest, this->getSmallestNode(r));
+    int height;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = joinNodes(l, heightOf(l), r, heightOf(r), height);
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = r != NULL ? rightLargest : leftLargest;
+}
+
+/*
+ * Merges other into this tree, leaving other empty. Where both trees have
+ * a key, the item keeps this tree's node and takes the value
+ * combine(thisValue, otherValue). With threads > 1 the two halves of each
+ * step are merged on different threads, so combine may be called
+ * concurrently. If combine throws, both trees are left empty.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename Combine>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::unionWith(AVLTree& other, Combine combine, unsigned threads)
+{
+    static_assert(std::is_empty<Arena>::value, "unionWith() moves nodes between trees, so their arena must be stateless");
+    if(&other == this)
+        return;
+    NodeType* a = getRoot();
+    NodeType* b = other.getRoot();
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = NULL;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = NULL;
+    other.root_ = NULL;
+    other.largest_ = NULL;
+    int height;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = unionNodes(a, heightOf(a), b, heightOf(b), combine, threads, height);
+    this->rethread();
+}
+
+/*
+ * Keeps only the keys that are also in other, with the value
+ * combine(thisValue, otherValue), and empties other. Threads and
+ * exceptions are as for unionWith.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename Combine>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::intersectWith(AVLTree& other, Combine combine, unsigned threads)
+{
+    static_assert(std::is_empty<Arena>::value, "intersectWith() moves nodes between trees, so their arena must be stateless");
+    if(&other == this)
+        return;
+    NodeType* a = getRoot();
+    NodeType* b = other.getRoot();
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = NULL;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = NULL;
+    other.root_ = NULL;
+    other.largest_ = NULL;
+    int height;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = intersectNodes(a, heightOf(a), b, heightOf(b), combine, threads, height);
+    this->rethread();
+}
+
+/*
+ * Removes the keys that are in other, and empties other.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::differenceWith(AVLTree& other, unsigned threads)
+{
+    static_assert(std::is_empty<Arena>::value, "differenceWith() moves nodes between trees, so their arena must be stateless");
+    if(&other == this){
+        clear();
+        return;
+    }
+    NodeType* a = getRoot();
+    NodeType* b = other.getRoot();
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = NULL;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::largest_ = NULL;
+    other.root_ = NULL;
+    other.largest_ = NULL;
+    int height;
+    AVLTree<Key, Value, Arena, NodeType, Compare>::root_ = differenceNodes(a, heightOf(a), b, heightOf(b), threads, height);
+    this->rethread();
+}
+
+/*
+ * Returns the height of the subtree at root in O(log n), by following
+ * the taller child down.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+int AVLTree<Key, Value, Arena, NodeType, Compare>::heightOf(NodeType* root)
+{
+    int height = 0;
+    for(; root != NULL; ++height)
+        root = root->getBalance() < 0 ? root->getLeft() : root->getRight();
+    return height;
+}
+
+/*
+ * Detaches root (of the given height) from its children, handing them
+ * back as left and right with their heights.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::expose(NodeType* root, int height, NodeType*& left, int& leftHeight,
+                                                  NodeType*& right, int& rightHeight)
+{
+    left = root->getLeft();
+    right = root->getRight();
+    leftHeight = height - 1 - (root->getBalance() > 0 ? 1 : 0);
+    rightHeight = height - 1 - (root->getBalance() < 0 ? 1 : 0);
+    if(left != NULL)
+        left->setParent(NULL);
+    if(right != NULL)
+        right->setParent(NULL);
+    root->setLeft(NULL);
+    root->setRight(NULL);
+    root->setParent(NULL);
+}
+
+/*
+ * Joins the detached subtrees left and right (heights given) under the
+ * detached node pivot, all of left's keys being smaller than pivot's and
+ * all of right's larger. If one side is more than one level taller,
+ * pivot goes down that side's inner spine to the first subtree no more
+ * than one level taller than the other side, takes its place, and the
+ * path above is fixed up with rotate. Costs O(|leftHeight - rightHeight| + 1).
+ * Returns the new root and sets height. Touches nothing outside the
+ * subtrees, so disjoint joins can run on different threads.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::joinNodes(NodeType* left, int leftHeight, NodeType* pivot,
+                                                          NodeType* right, int rightHeight, int& height)
+{
+    pivot->setParent(NULL);
+    if(leftHeight <= rightHeight + 1 && rightHeight <= leftHeight + 1){ // Close enough to hang both off pivot
+        pivot->setLeft(left);
+        pivot->setRight(right);
+        if(left != NULL)
+            left->setParent(pivot);
+        if(right != NULL)
+            right->setParent(pivot);
+        pivot->setBalance(rightHeight - leftHeight);
+        pivot->recount();
+        height = std::max(leftHeight, rightHeight) + 1;
+        return pivot;
+    }
+
+    bool leftTaller = leftHeight > rightHeight;
+    int dir = leftTaller ? 1 : -1; // The side of the tall tree to walk down
+    NodeType* tall = leftTaller ? left : right;
+    NodeType* other = leftTaller ? right : left;
+    int otherHeight = leftTaller ? rightHeight : leftHeight;
+    NodeType* p = NULL;
+    NodeType* c = tall;
+    int h = leftTaller ? leftHeight : rightHeight;
+    while(h > otherHeight + 1){
+        p = c;
+        h -= (c->getBalance() == -dir) ? 2 : 1;
+        c = dir == 1 ? c->getRight() : c->getLeft();
+    }
+
+    if(leftTaller){
+        pivot->setLeft(c);
+        pivot->setRight(other);
+        p->setRight(pivot);
+    } else {
+        pivot->setLeft(other);
+        pivot->setRight(c);
+        p->setLeft(pivot);
+    }
+    if(c != NULL)
+        c->setParent(pivot);
+    if(other != NULL)
+        other->setParent(pivot);
+    pivot->setParent(p);
+    pivot->setBalance(dir * (otherHeight - h));
+    pivot->recount();
+    if(NodeType::counted)
+        recountPath(p);
+    Node<Key, Value>* root = tall;
+    bool grew = joinFix(p, dir, root);
+    height = (leftTaller ? leftHeight : rightHeight) + (grew ? 1 : 0);
+    return static_cast<NodeType*>(root);
+}
+
+/*
+ * Joins the detached subtrees left and right with no pivot, by taking the
+ * largest node of left out to serve as one. Costs O(log n).
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::joinNodes(NodeType* left, int leftHeight,
+                                                          NodeType* right, int rightHeight, int& height)
+{
+    if(left == NULL){
+        height = rightHeight;
+        return right;
+    }
+    NodeType* last;
+    int restHeight;
+    NodeType* rest = splitLast(left, leftHeight, last, restHeight);
+    return joinNodes(rest, restHeight, last, right, rightHeight, height);
+}
+
+/*
+ * The subtree on side diff of n (1 right, -1 left) just got one level
+ * taller. Like insertFix, but the taller child may have a balance of 0,
+ * so a single rotation can leave the subtree taller and the fix goes on
+ * up. root is the top of the subtree being fixed, and is updated if that
+ * gets rotated. Returns whether the root ended up taller.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+bool AVLTree<Key, Value, Arena, NodeType, Compare>::joinFix(NodeType* n, int diff, Node<Key, Value>*& root)
+{
+    for(;;){
+        NodeType* p = n->getParent();
+        int pdiff = (p != NULL && p->getLeft() == n) ? -1 : 1;
+        int balance = n->getBalance() + diff;
+        if(balance == 0){ // Shorter side caught up, height unchanged
+            n->setBalance(0);
+            return false;
+        }
+        if(balance == diff){ // Taller, keep going
+            n->setBalance(diff);
+            if(p == NULL)
+                return true;
+            n = p;
+            diff = pdiff;
+            continue;
+        }
+        NodeType* c = diff == 1 ? n->getRight() : n->getLeft();
+        if(c->getBalance() == diff){ // Zig-zig, back to the old height
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+            rotate(n, diff, root);
+            n->setBalance(0);
+            c->setBalance(0);
+            return false;
+        }
+        if(c->getBalance() == 0){ // Zig-zig that stays taller
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+            rotate(n, diff, root);
+            n->setBalance(diff);
+            c->setBalance(-diff);
+            if(p == NULL)
+                return true;
+            n = p;
+            diff = pdiff;
+            continue;
+        }
+        // Zig-zag, back to the old height
+        BST_STAT(STAT_DOUBLE_ROTATIONS, 1);
+        NodeType* g = diff == 1 ? c->getLeft() : c->getRight();
+        int gBal = g->getBalance();
+        rotate(c, -diff, root);
+        rotate(n, diff, root);
+        n->setBalance(gBal == diff ? -diff : 0);
+        c->setBalance(gBal == -diff ? diff : 0);
+        g->setBalance(0);
+        return false;
+    }
+}
+
+/*
+ * Cuts the subtree at root (of the given height) into left, with the keys
+ * less than key, and right, with the keys greater. The node holding key,
+ * if any, comes back detached as match (NULL otherwise). Each level
+ * detaches root from its children, recurses into the side key falls in,
+ * and joins root and the untouched child onto the matching piece.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::splitNodes(NodeType* root, int height, const Key& key,
+                                                      NodeType*& left, int& leftHeight, NodeType*& match,
+                                                      NodeType*& right, int& rightHeight) const
+{
+    bool bounded;
+    splitNodes(root, height, key, left, leftHeight, match, right, rightHeight, bounded);
+}
+
+/*
+ * One comparison per level: root goes left if its key is less than key,
+ * and right otherwise. Only the lowest node to go right can hold key.
+ * bounded tells the caller whether any node in the subtree went right;
+ * the first level that hears it didn't is that lowest node, and one more
+ * comparison there decides whether it is the match.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::splitNodes(NodeType* root, int height, const Key& key,
+                                                      NodeType*& left, int& leftHeight, NodeType*& match,
+                                                      NodeType*& right, int& rightHeight, bool& bounded) const
+{
+    if(root == NULL){
+        left = match = right = NULL;
+        leftHeight = rightHeight = 0;
+        bounded = false;
+        return;
+    }
+    NodeType *l, *r;
+    int lh, rh;
+    expose(root, height, l, lh, r, rh);
+
+    NodeType* middle;
+    int middleHeight;
+    if(this->compare_.less(root->getKey(), key)){ // root and its left subtree go left
+        splitNodes(r, rh, key, middle, middleHeight, match, right, rightHeight, bounded);
+        left = joinNodes(l, lh, root, middle, middleHeight, leftHeight);
+    } else {
+        splitNodes(l, lh, key, left, leftHeight, match, middle, middleHeight, bounded);
+        if(!bounded && !this->compare_.less(key, root->getKey())){ // root holds key
+            match = root;
+            right = joinNodes(middle, middleHeight, r, rh, rightHeight);
+        } else
+            right = joinNodes(middle, middleHeight, root, r, rh, rightHeight);
+        bounded = true;
+    }
+}
+
+/*
+ * Takes the largest node out of the subtree at root (of the given height)
+ * into last, and returns the rest of the subtree, setting restHeight.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::splitLast(NodeType* root, int height, NodeType*& last, int& restHeight)
+{
+    NodeType *l, *r;
+    int lh, rh;
+    expose(root, height, l, lh, r, rh);
+    if(r == NULL){
+        last = root;
+        restHeight = lh;
+        return l;
+    }
+    int middleHeight;
+    NodeType* middle = splitLast(r, rh, last, middleHeight);
+    return joinNodes(l, lh, root, middle, middleHeight, restHeight);
+}
+
+/*
+ * The set operations below all take two detached subtrees, a from this
+ * tree and b from the other, and return the detached result. Each exposes
+ * b's root, splits a at its key, recurses on the two pairs of halves and
+ * joins the results back up. On an exception every node passed in has
+ * been freed.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename Combine>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::unionNodes(NodeType* a, int aHeight, NodeType* b, int bHeight,
+                                                           Combine& combine, unsigned threads, int& height)
+{
+    if(a == NULL){
+        height = bHeight;
+        return b;
+    }
+    if(b == NULL){
+        height = aHeight;
+        return a;
+    }
+    NodeType *l1, *match, *r1, *l2, *r2;
+    int lh1, rh1, lh2, rh2;
+    expose(b, bHeight, l2, lh2, r2, rh2);
+    splitNodes(a, aHeight, b->getKey(), l1, lh1, match, r1, rh1);
+    NodeType* pivot = b;
+    if(match != NULL){
+        try {
+            match->getValue() = combine(match->getValue(), b->getValue());
+        } catch(...) {
+            this->clearHelper(l1);
+            this->clearHelper(r1);
+            this->clearHelper(l2);
+            this->clearHelper(r2);
+            this->destroyNode(match);
+            this->destroyNode(b);
+            throw;
+        }
+        this->destroyNode(b);
+        pivot = match;
+    }
+
+    NodeType *left, *right;
+    int leftHeight, rightHeight;
+    try {
+        recurseBoth([&](NodeType* x, int xh, NodeType* y, int yh, unsigned t, int& h) {
+            return unionNodes(x, xh, y, yh, combine, t, h);
+        }, l1, lh1, l2, lh2, r1, rh1, r2, rh2, threads, left, leftHeight, right, rightHeight);
+    } catch(...) {
+        this->destroyNode(pivot);
+        throw;
+    }
+    return joinNodes(left, leftHeight, pivot, right, rightHeight, height);
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename Combine>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::intersectNodes(NodeType* a, int aHeight, NodeType* b, int bHeight,
+                                                               Combine& combine, unsigned threads, int& height)
+{
+    if(a == NULL || b == NULL){
+        this->clearHelper(a);
+        this->clearHelper(b);
+        height = 0;
         return NULL;
-    else
-        return current->getParent(); // If right child, return parent
+    }
+    NodeType *l1, *match, *r1, *l2, *r2;
+    int lh1, rh1, lh2, rh2;
+    expose(b, bHeight, l2, lh2, r2, rh2);
+    splitNodes(a, aHeight, b->getKey(), l1, lh1, match, r1, rh1);
+    if(match != NULL){
+        try {
+            match->getValue() = combine(match->getValue(), b->getValue());
+        } catch(...) {
+            this->clearHelper(l1);
+            this->clearHelper(r1);
+            this->clearHelper(l2);
+            this->clearHelper(r2);
+            this->destroyNode(match);
+            this->destroyNode(b);
+            throw;
+        }
+    }
+    this->destroyNode(b);
+
+    NodeType *left, *right;
+    int leftHeight, rightHeight;
+    try {
+        recurseBoth([&](NodeType* x, int xh, NodeType* y, int yh, unsigned t, int& h) {
+            return intersectNodes(x, xh, y, yh, combine, t, h);
+        }, l1, lh1, l2, lh2, r1, rh1, r2, rh2, threads, left, leftHeight, right, rightHeight);
+    } catch(...) {
+        if(match != NULL)
+            this->destroyNode(match);
+        throw;
+    }
+    if(match != NULL)
+        return joinNodes(left, leftHeight, match, right, rightHeight, height);
+    return joinNodes(left, leftHeight, right, rightHeight, height);
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::differenceNodes(NodeType* a, int aHeight, NodeType* b, int bHeight,
+                                                                unsigned threads, int& height)
+{
+    if(a == NULL || b == NULL){
+        this->clearHelper(b);
+        height = a == NULL ? 0 : aHeight;
+        return a;
+    }
+    NodeType *l1, *match, *r1, *l2, *r2;
+    int lh1, rh1, lh2, rh2;
+    expose(b, bHeight, l2, lh2, r2, rh2);
+    splitNodes(a, aHeight, b->getKey(), l1, lh1, match, r1, rh1);
+    this->destroyNode(b);
+    if(match != NULL)
+        this->destroyNode(match);
+
+    NodeType *left, *right;
+    int leftHeight, rightHeight;
+    recurseBoth([&](NodeType* x, int xh, NodeType* y, int yh, unsigned t, int& h) {
+        return differenceNodes(x, xh, y, yh, t, h);
+    }, l1, lh1, l2, lh2, r1, rh1, r2, rh2, threads, left, leftHeight, right, rightHeight);
+    return joinNodes(left, leftHeight, right, rightHeight, height);
+}
+
+/*
+ * Runs recurse on (l1, l2) into left and on (r1, r2) into right. While
+ * there are threads to spare and both trees are big enough to be worth
+ * it, the left pair goes to another thread. On an exception, everything
+ * not yet consumed or produced is freed.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename Recurse>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::recurseBoth(Recurse recurse, NodeType* l1, int lh1, NodeType* l2, int lh2,
+                                                       NodeType* r1, int rh1, NodeType* r2, int rh2, unsigned threads,
+                                                       NodeType*& left, int& leftHeight, NodeType*& right, int& rightHeight)
+{
+    if(threads <= 1 || std::min(std::max(lh1, rh1), std::max(lh2, rh2)) < AVL_PARALLEL_SET_HEIGHT){
+        try {
+            left = recurse(l1, lh1, l2, lh2, threads, leftHeight);
+        } catch(...) {
+            this->clearHelper(r1);
+            this->clearHelper(r2);
+            throw;
+        }
+        try {
+            right = recurse(r1, rh1, r2, rh2, threads, rightHeight);
+        } catch(...) {
+            this->clearHelper(left);
+            throw;
+        }
+        return;
+    }
+    unsigned leftThreads = threads / 2;
+    std::future<NodeType*> leftFuture = std::async(std::launch::async, [&]() {
+        return recurse(l1, lh1, l2, lh2, leftThreads, leftHeight);
+    });
+    try {
+        right = recurse(r1, rh1, r2, rh2, threads - leftThreads, rightHeight);
+    } catch(...) {
+        try {
+            this->clearHelper(leftFuture.get());
+        } catch(...) { }
+        throw;
+    }
+    try {
+        left = leftFuture.get();
+    } catch(...) {
+        this->clearHelper(right);
+        throw;
+    }
+}
+
+/*
+ * Builds a subtree from the next n items of it, consuming them in order,
+ * and sets height to its height. The left half gets the extra item, so
+ * every balance is 0 or -1. The root's parent is left for the caller.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename ForwardIterator>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::buildSorted(ForwardIterator& it, std::size_t n, int& height,
+                                                             unsigned threads, std::forward_iterator_tag tag)
+{
+    if(n == 0){
+        height = 0;
+        return NULL;
+    }
+    int leftHeight, rightHeight;
+    NodeType* left = buildSorted(it, n / 2, leftHeight, threads, tag);
+    NodeType* node = NULL;
+    NodeType* right = NULL;
+    try {
+        node = this->createNode(static_cast<NodeType*>(NULL), *it);
+        ++it;
+        right = buildSorted(it, n - 1 - n / 2, rightHeight, threads, tag);
+    } catch(...) { // Don't leak what was already built
+        this->clearHelper(left);
+        if(node != NULL)
+            this->destroyNode(node);
+        throw;
+    }
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != NULL)
+        left->setParent(node);
+    if(right != NULL)
+        right->setParent(node);
+    node->setBalance(rightHeight - leftHeight);
+    node->recount();
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/*
+ * Random access version of the above, which builds the left half on
+ * another thread while there are threads to spare and the subtree is big
+ * enough to be worth it.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+template<typename RandomIterator>
+NodeType* AVLTree<Key, Value, Arena, NodeType, Compare>::buildSorted(RandomIterator& it, std::size_t n, int& height,
+                                                             unsigned threads, std::random_access_iterator_tag tag)
+{
+    if(threads <= 1 || n < AVL_PARALLEL_BUILD_MIN){
+        NodeType* root = buildSorted(it, n, height, 1, std::forward_iterator_tag());
+        return root;
+    }
+    std::size_t leftSize = n / 2;
+    unsigned leftThreads = threads / 2;
+    int leftHeight, rightHeight;
+    RandomIterator leftIt = it;
+    std::future<NodeType*> leftFuture = std::async(std::launch::async, [&]() {
+        return buildSorted(leftIt, leftSize, leftHeight, leftThreads, tag);
+    });
+
+    RandomIterator mid = it + leftSize;
+    RandomIterator rightIt = mid + 1;
+    NodeType* node = NULL;
+    NodeType* right = NULL;
+    try {
+        right = buildSorted(rightIt, n - 1 - leftSize, rightHeight, threads - leftThreads, tag);
+        node = this->createNode(static_cast<NodeType*>(NULL), *mid);
+    } catch(...) { // Don't leak what was already built
+        this->clearHelper(right);
+        try {
+            this->clearHelper(leftFuture.get());
+        } catch(...) { }
+        throw;
+    }
+    NodeType* left;
+    try {
+        left = leftFuture.get();
+    } catch(...) {
+        this->clearHelper(right);
+        this->destroyNode(node);
+        throw;
+    }
+    it = rightIt;
+
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != NULL)
+        left->setParent(node);
+    if(right != NULL)
+        right->setParent(node);
+    node->setBalance(rightHeight - leftHeight);
+    node->recount();
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/*
+ * Recounts every node from n up to the root, after n's subtree gained or
+ * lost a node.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+void AVLTree<Key, Value, Arena, NodeType, Compare>::recountPath(NodeType* n)
+{
+    for(; n != NULL; n = n->getParent())
+        n->recount();
+}
+
+/*
+ * Returns the number of items in the tree. Counted nodes hold it at the
+ * root; plain ones are walked and counted.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::size_t AVLTree<Key, Value, Arena, NodeType, Compare>::size() const
+{
+    return countItems(std::integral_constant<bool, NodeType::counted>());
 }
 
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::size_t AVLTree<Key, Value, Arena, NodeType, Compare>::countItems(std::true_type) const
+{
+    return NodeType::countOf(getRoot());
+}
+
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::size_t AVLTree<Key, Value, Arena, NodeType, Compare>::countItems(std::false_type) const
+{
+    std::size_t count = 0;
+    for(iterator it = this->begin(); it != this->end(); ++it)
+        ++count;
+    return count;
+}
+
+/*
+ * Returns an iterator to the k-th smallest item (counting from 0),
+ * or end() if there are k items or fewer.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator
+AVLTree<Key, Value, Arena, NodeType, Compare>::select(std::size_t k) const
+{
+    static_assert(NodeType::counted, "select/rank/jump need OrderStatisticTree");
+    NodeType* n = getRoot();
+    while(n != NULL){
+        std::size_t leftCount = NodeType::countOf(n->getLeft());
+        if(k < leftCount) // It's in the left subtree
+            n = n->getLeft();
+        else if(k == leftCount) // It's this one
+            break;
+        else { // Skip the left subtree and this node
+            k -= leftCount + 1;
+            n = n->getRight();
+        }
+    }
+    return this->makeIterator(n);
+}
+
+/*
+ * Returns the number of keys smaller than key, which is also the position
+ * key has (or would have) in an in-order walk.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::size_t AVLTree<Key, Value, Arena, NodeType, Compare>::rank(const Key& key) const
+{
+    static_assert(NodeType::counted, "select/rank/jump need OrderStatisticTree");
+    std::size_t smaller = 0;
+    NodeType* n = getRoot();
+    while(n != NULL){
+        if(this->compare_.less(n->getKey(), key)){ // n and its left subtree are all smaller
+            smaller += NodeType::countOf(n->getLeft()) + 1;
+            n = n->getRight();
+        } else
+            n = n->getLeft();
+    }
+    return smaller;
+}
+
+/*
+ * Returns the position of the item at it, or size() for end().
+ * Walks up from the node, so it needs no key comparisons.
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+std::size_t AVLTree<Key, Value, Arena, NodeType, Compare>::rank(iterator it) const
+{
+    static_assert(NodeType::counted, "select/rank/jump need OrderStatisticTree");
+    NodeType* n = static_cast<NodeType*>(this->getNode(it));
+    if(n == NULL)
+        return size();
+    std::size_t smaller = NodeType::countOf(n->getLeft());
+    for(NodeType* p = n->getParent(); p != NULL; n = p, p = p->getParent()){
+        if(p->getRight() == n) // Coming up from the right, p and its left subtree are smaller
+            smaller += NodeType::countOf(p->getLeft()) + 1;
+    }
+    return smaller;
+}
+
+/*
+ * The equivalent of it + n for a random access iterator, in O(log n).
+ * Jumping outside the tree gives end().
+ */
+template<class Key, class Value, class Arena, class NodeType, class Compare>
+typename AVLTree<Key, Value, Arena, NodeType, Compare>::iterator
+AVLTree<Key, Value, Arena, NodeType, Compare>::jump(iterator it, std::ptrdiff_t n) const
+{
+    static_assert(NodeType::counted, "select/rank/jump need OrderStatisticTree");
+    std::ptrdiff_t target = static_cast<std::ptrdiff_t>(rank(it)) + n;
+    if(target < 0)
+        return this->end();
+    return select(static_cast<std::size_t>(target));
+}
+
+/*
+ * An AVLTree whose nodes count their subtrees, so select, rank and jump work.
+ */
+template <class Key, class Value, class Arena = HeapArena, class Compare = std::less<Key> >
+using OrderStatisticTree = AVLTree<Key, Value, Arena, CountedAVLNode<Key, Value>, Compare>;
+
 #endif
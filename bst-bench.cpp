@@ -0,0 +1,355 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+
+using namespace std;
+
+// Single-threaded throughput and latency of BinarySearchTree, AVLTree,
+// RedBlackTree, SplayTree (top-down and bottom-up) and std::map. Each
+// structure is preloaded with n keys, then runs a fixed
+// sequence of operations drawn from [0, 2n), so about half the lookups
+// hit. An insert that adds a key is paired with the removal of a random
+// key in the tree, and a remove that takes one out with the insert of a
+// random key not in it, so the tree holds n keys throughout. Those paired
+// operations run and are timed like the rest, so ops counts them and the
+// write-heavy and delete-heavy mixes both end up near half inserts and
+// half removes among their writes. live_size is the key count after the
+// run. Every (structure, workload, size) case runs in its own child
+// process, which keeps allocator state apart and makes peak RSS per case.
+// Peak RSS includes the benchmark's own arrays, which are the same size
+// for every structure. Latencies include one clock read, about 20 ns.
+//
+//   ./bst-bench [max size] [ops per case]
+//
+// Sizes go up by 10x from 1000 to max size. Output is CSV on stdout.
+
+enum Pattern { SEQUENTIAL, UNIFORM, ZIPFIAN, HOTSET };
+enum OpType { FIND, INSERT, REMOVE };
+
+struct Workload
+{
+    const char* name;
+    Pattern pattern;
+    int findPct, insertPct; // The rest remove
+};
+
+static const Workload WORKLOADS[] = {
+    { "sequential",   SEQUENTIAL, 50, 25 },
+    { "random",       UNIFORM,    50, 25 },
+    { "zipfian",      ZIPFIAN,    90,  5 },
+    { "hot-1pct",     HOTSET,     90,  5 }, // 90% of operations on 1% of keys
+    { "read-heavy",   UNIFORM,    95,  5 },
+    { "write-heavy",  UNIFORM,    10, 90 },
+    { "delete-heavy", UNIFORM,    10, 10 },
+};
+
+// Past this size, sorted input makes BinarySearchTree a list with O(n)
+// steps, and the case would take hours.
+static const long BST_SEQUENTIAL_MAX = 10000;
+
+// Counts the items with an in-order walk, for trees with no size().
+template<typename Tree>
+long countItems(const Tree& tree)
+{
+    long count = 0;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        count++;
+    }
+    return count;
+}
+
+struct BstMap
+{
+    BinarySearchTree<int,int> tree;
+
+    void insert(int k) { tree.insert(make_pair(k, k)); }
+    void remove(int k) { tree.remove(k); }
+    bool find(int k) { return tree.find(k) != tree.end(); }
+    long size() const { return countItems(tree); }
+};
+
+struct AvlMap
+{
+    AVLTree<int,int> tree;
+
+    void insert(int k) { tree.insert(make_pair(k, k)); }
+    void remove(int k) { tree.remove(k); }
+    bool find(int k) { return tree.find(k) != tree.end(); }
+    long size() const { return countItems(tree); }
+};
+
+struct RbMap
+{
+    RedBlackTree<int,int> tree;
+
+    void insert(int k) { tree.insert(make_pair(k, k)); }
+    void remove(int k) { tree.remove(k); }
+    bool find(int k) { return tree.find(k) != tree.end(); }
+    long size() const { return countItems(tree); }
+};
+
+template<SplayMode Mode>
+struct SplayMap
+{
+    SplayTree<int,int> tree;
+
+    SplayMap() : tree(Mode) { }
+    void insert(int k) { tree.insert(make_pair(k, k)); }
+    void remove(int k) { tree.remove(k); }
+    bool find(int k) { return tree.find(k) != tree.end(); }
+    long size() const { return countItems(tree); }
+};
+
+struct StdMap
+{
+    map<int,int> tree;
+
+    void insert(int k) { tree[k] = k; }
+    void remove(int k) { tree.erase(k); }
+    bool find(int k) { return tree.find(k) != tree.end(); }
+    long size() const { return tree.size(); }
+};
+
+/**
+ * Draws ranks from [0, n) with P(rank i) proportional to 1 / (i+1)^theta,
+ * using the method of Gray et al. as in YCSB. Setup is O(n).
+ */
+class Zipf
+{
+public:
+    Zipf(long n, double theta) : n_(n), theta_(theta)
+    {
+        double zetan = 0;
+        for(long i = 1; i <= n; i++) {
+            zetan += 1 / pow((double)i, theta);
+        }
+        double zeta2 = 1 + 1 / pow(2.0, theta);
+        alpha_ = 1 / (1 - theta);
+        eta_ = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        half_ = 1 + pow(0.5, theta);
+        zetan_ = zetan;
+    }
+
+    template<typename Gen>
+    long operator()(Gen& gen)
+    {
+        double u = uniform_real_distribution<double>(0, 1)(gen);
+        double uz = u * zetan_;
+        if(uz < 1) return 0;
+        if(uz < half_) return 1;
+        return min(n_ - 1, (long)(n_ * pow(eta_ * u - eta_ + 1, alpha_)));
+    }
+
+private:
+    long n_;
+    double theta_, alpha_, eta_, half_, zetan_;
+};
+
+struct Op
+{
+    int key;
+    OpType type;
+};
+
+// Preload keys, in insertion order: the even keys of [0, 2n), ascending
+// for the sequential workload and shuffled otherwise.
+vector<int> preloadKeys(long n, const Workload& w, mt19937_64& gen)
+{
+    vector<int> keys(n);
+    for(long i = 0; i < n; i++) {
+        keys[i] = (int)(2 * i);
+    }
+    if(w.pattern != SEQUENTIAL) {
+        shuffle(keys.begin(), keys.end(), gen);
+    }
+    return keys;
+}
+
+// The keys of [0, 2n), split into those in the tree and those not. Each
+// side is kept in a vector with each key's index, so a random key can be
+// drawn from either side and moved to the other in O(1).
+class KeySet
+{
+public:
+    // Starts with the even keys in, as preloadKeys leaves the tree
+    explicit KeySet(long n) : in_(2 * n), where_(2 * n)
+    {
+        for(long k = 0; k < 2 * n; k++) {
+            in_[k] = k % 2 == 0;
+            vector<int>& side = in_[k] ? present_ : absent_;
+            where_[k] = side.size();
+            side.push_back((int)k);
+        }
+    }
+
+    bool contains(int k) const { return in_[k]; }
+
+    template<typename Gen>
+    int pick(bool present, Gen& gen) const
+    {
+        const vector<int>& side = present ? present_ : absent_;
+        return side[gen() % side.size()];
+    }
+
+    // Moves k to the other side
+    void flip(int k)
+    {
+        vector<int>& from = in_[k] ? present_ : absent_;
+        vector<int>& to = in_[k] ? absent_ : present_;
+        from[where_[k]] = from.back();
+        where_[from.back()] = where_[k];
+        from.pop_back();
+        where_[k] = to.size();
+        to.push_back(k);
+        in_[k] = !in_[k];
+    }
+
+private:
+    vector<bool> in_;
+    vector<size_t> where_;
+    vector<int> present_, absent_;
+};
+
+// Draws count operations for w, each followed by the paired operation
+// that keeps the tree at n keys if it changes the key count.
+vector<Op> makeOps(long n, long count, const Workload& w, mt19937_64& gen)
+{
+    long space = 2 * n;
+    KeySet live(n);
+    vector<Op> ops;
+    ops.reserve(2 * count);
+    Zipf* zipf = w.pattern == ZIPFIAN ? new Zipf(space, 0.99) : NULL;
+    for(long i = 0; i < count; i++) {
+        long k;
+        if(w.pattern == SEQUENTIAL) k = i % space;
+        else if(w.pattern == UNIFORM) k = gen() % space;
+        else if(w.pattern == HOTSET && gen() % 10 != 0) k = ((gen() % (space / 100 + 1)) * 2654435761UL) % space;
+        else if(w.pattern == HOTSET) k = gen() % space;
+        else k = ((*zipf)(gen) * 2654435761UL) % space; // Scatter the hot ranks over the key space
+        int pick = gen() % 100;
+        Op op = { (int)k, pick < w.findPct ? FIND : (pick < w.findPct + w.insertPct ? INSERT : REMOVE) };
+        ops.push_back(op);
+        if(op.type == FIND || live.contains(op.key) != (op.type == REMOVE)) {
+            continue; // A lookup, an overwrite or a missed remove
+        }
+        Op paired = { live.pick(op.type == INSERT, gen), op.type == REMOVE ? INSERT : REMOVE };
+        live.flip(op.key);
+        live.flip(paired.key);
+        ops.push_back(paired);
+    }
+    delete zipf;
+    return ops;
+}
+
+long percentile(vector<uint32_t>& ns, double p)
+{
+    size_t i = min(ns.size() - 1, (size_t)(p * ns.size()));
+    nth_element(ns.begin(), ns.begin() + i, ns.end());
+    return ns[i];
+}
+
+template<typename Map>
+void runCase(const char* name, const Workload& w, long n, long count)
+{
+    mt19937_64 gen(n * 31 + (&w - WORKLOADS));
+    vector<int> keys = preloadKeys(n, w, gen);
+    vector<Op> ops = makeOps(n, count, w, gen);
+    count = ops.size();
+    vector<uint32_t> latency(count);
+
+    Map* map = new Map;
+    for(long i = 0; i < n; i++) {
+        map->insert(keys[i]);
+    }
+
+    // Throughput from one untimed pass, then latency from a second pass
+    // over the same operations, so the clock reads don't count against it.
+    // The ops were drawn against the preloaded keys, so the tree is built
+    // again in between.
+    long hits = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(long i = 0; i < count; i++) {
+        if(ops[i].type == FIND) hits += map->find(ops[i].key);
+        else if(ops[i].type == INSERT) map->insert(ops[i].key);
+        else map->remove(ops[i].key);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    delete map;
+    map = new Map; // Left to the process exit, so teardown is not timed
+    for(long i = 0; i < n; i++) {
+        map->insert(keys[i]);
+    }
+    vector<int>().swap(keys);
+
+    chrono::steady_clock::time_point before = chrono::steady_clock::now();
+    for(long i = 0; i < count; i++) {
+        if(ops[i].type == FIND) hits += map->find(ops[i].key);
+        else if(ops[i].type == INSERT) map->insert(ops[i].key);
+        else map->remove(ops[i].key);
+        chrono::steady_clock::time_point after = chrono::steady_clock::now();
+        latency[i] = (uint32_t)chrono::duration_cast<chrono::nanoseconds>(after - before).count();
+        before = after;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << name << "," << w.name << "," << n << "," << map->size() << "," << count << ","
+         << (long)(count / seconds) << "," << percentile(latency, 0.50) << ","
+         << percentile(latency, 0.99) << "," << usage.ru_maxrss << endl;
+    if(hits < 0) cout << hits; // Keeps the lookups from being optimized away
+}
+
+// Runs one case in a child process and waits for it.
+template<typename Map>
+void forkCase(const char* name, const Workload& w, long n, long count)
+{
+    cout.flush();
+    pid_t pid = fork();
+    if(pid == 0) {
+        runCase<Map>(name, w, n, count);
+        cout.flush();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cerr << name << " " << w.name << " " << n << " failed (out of memory?)" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long maxSize = argc > 1 ? atol(argv[1]) : 1000000;
+    long count = argc > 2 ? atol(argv[2]) : 500000;
+
+    cout << "structure,workload,size,live_size,ops,ops_per_sec,p50_ns,p99_ns,peak_rss_kb" << endl;
+    for(long n = 1000; n <= maxSize; n *= 10) {
+        for(size_t w = 0; w < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); w++) {
+            if(WORKLOADS[w].pattern == SEQUENTIAL && n > BST_SEQUENTIAL_MAX) {
+                cerr << "skipping bst " << WORKLOADS[w].name << " " << n << ": unbalanced, O(n) per op" << endl;
+            } else {
+                forkCase<BstMap>("bst", WORKLOADS[w], n, count);
+            }
+            forkCase<AvlMap>("avl", WORKLOADS[w], n, count);
+            forkCase<RbMap>("rb", WORKLOADS[w], n, count);
+            forkCase<SplayMap<SPLAY_TOP_DOWN> >("splay", WORKLOADS[w], n, count);
+            forkCase<SplayMap<SPLAY_BOTTOM_UP> >("splay-bottom-up", WORKLOADS[w], n, count);
+            forkCase<StdMap>("std::map", WORKLOADS[w], n, count);
+        }
+    }
+    return 0;
+}
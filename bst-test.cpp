@@ -1,10 +1,42 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <string>
+#include <cctype>
+#include <functional>
 #include "bst.h"
 #include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "btree.h"
+#include "persistentavl.h"
 
 using namespace std;
 
+// Orders strings ignoring case, with a three-way compare() so lookups stop
+// at the matching node.
+struct CaseInsensitive
+{
+    int compare(const string& a, const string& b) const
+    {
+        for(size_t i = 0; i < a.size() && i < b.size(); i++) {
+            int diff = tolower((unsigned char)a[i]) - tolower((unsigned char)b[i]);
+            if(diff != 0) return diff;
+        }
+        return (int)a.size() - (int)b.size();
+    }
+    bool operator()(const string& a, const string& b) const { return compare(a, b) < 0; }
+};
+
+// Compares strings with C strings too, so lookups by const char* don't
+// build a temporary string.
+struct TransparentLess
+{
+    typedef void is_transparent;
+    bool operator()(const string& a, const string& b) const { return a < b; }
+    bool operator()(const string& a, const char* b) const { return a.compare(b) < 0; }
+    bool operator()(const char* a, const string& b) const { return b.compare(a) > 0; }
+};
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +76,236 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Slab-allocated AVL Tree tests
+    AVLTree<int,int,SlabArena<> > st;
+    for(int i = 0; i < 1000; i++) {
+        st.insert(std::make_pair(i, i*i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        st.remove(i);
+    }
+    int count = 0;
+    for(int i = 0; i < 1000; i++) {
+        if(st.find(i) != st.end()) count++;
+    }
+    cout << "\nSlab AVLTree has " << count << " items, balanced: " << st.shape().balanced << endl;
+    st.clear();
+    cout << "Cleared, empty: " << st.empty() << endl;
+
+    // Bulk construction from sorted input
+    std::vector<std::pair<int,int> > sorted;
+    for(int i = 0; i < 100; i++) {
+        sorted.push_back(std::make_pair(i, i));
+    }
+    st.assignSorted(sorted.begin(), sorted.end());
+    cout << "Built from sorted range, balanced: " << st.shape().balanced
+         << ", find 42: " << st.find(42)->second << endl;
+
+    // Move-aware insertion
+    AVLTree<std::string, std::string> mt;
+    mt.insert(std::make_pair(std::string("x"), std::string("moved")));
+    cout << "\ntry_emplace new key inserted: " << mt.try_emplace("y", 3, 'y').second << endl;
+    cout << "try_emplace existing key inserted: " << mt.try_emplace("y", "ignored").second
+         << ", value " << mt["y"] << endl;
+    cout << "emplace existing key inserted: " << mt.emplace("x", "overwritten").second
+         << ", value " << mt["x"] << endl;
+
+    // Hinted appends
+    AVLTree<int,int> ht;
+    for(int i = 0; i < 100; i++) {
+        ht.insert(ht.end(), std::make_pair(i, i));
+    }
+    cout << "\nHinted AVLTree has " << ht.size() << " items, balanced: " << ht.shape().balanced << endl;
+
+    // Order statistics
+    OrderStatisticTree<int,int> ot;
+    for(int i = 0; i < 100; i++) {
+        ot.insert(std::make_pair(i * 10, i));
+    }
+    cout << "\nOrderStatisticTree size " << ot.size() << ", 90th percentile key "
+         << ot.select(ot.size() * 9 / 10)->first << ", rank of 455 is " << ot.rank(455)
+         << ", begin + 7 is " << ot.jump(ot.begin(), 7)->first << endl;
+
+    // Ordered range queries
+    cout << "\nlower_bound(455) " << ot.lower_bound(455)->first
+         << ", upper_bound(450) " << ot.upper_bound(450)->first
+         << ", floor(455) " << ot.floor(455)->first << endl;
+    cout << "Keys in [10, 15):";
+    BinarySearchTree<int,int>::Range r = ht.range(10, 15);
+    for(BinarySearchTree<int,int>::iterator it = r.begin(); it != r.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Newest-first scans
+    cout << "Last 3 keys:";
+    int shown = 0;
+    for(BinarySearchTree<int,int>::reverse_iterator it = ht.rbegin(); it != ht.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    BinarySearchTree<int,int>::const_iterator last = ht.cend();
+    --last;
+    cout << ", last via cend: " << last->first << endl;
+
+    // Batched lookups
+    int wanted[] = { 5, 500, 42, 99 };
+    BinarySearchTree<int,int>::iterator found[4];
+    ht.findBatch(wanted, 4, found);
+    cout << "Batch found:";
+    for(int i = 0; i < 4; i++) {
+        cout << " " << (found[i] == ht.end() ? -1 : found[i]->second);
+    }
+    cout << endl;
+
+    // Frozen snapshot
+    FrozenMap<int,int> frozen = ot.freeze();
+    cout << "\nFrozenMap size " << frozen.size() << ", find 450: " << frozen[450]
+         << ", 455 found: " << (frozen.find(455) != frozen.end()) << endl;
+    ot.remove(450);
+    ot.freeze(frozen);
+    cout << "Refrozen size " << frozen.size() << ", lower_bound(450) " << frozen.lower_bound(450)->first << endl;
+
+    // B+ tree engine
+    BTree<int,int,4> pt;
+    for(int i = 0; i < 1000; i++) {
+        pt.insert(std::make_pair(i, i*i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        pt.remove(i);
+    }
+    cout << "\nBTree has " << pt.size() << " items, pt[31] = " << pt[31]
+         << ", 30 found: " << (pt.find(30) != pt.end()) << endl;
+    pt.clear();
+    cout << "Cleared, empty: " << pt.empty() << endl;
+
+    // Persistent versions
+    PersistentAVLTree<int,int> vt;
+    for(int i = 0; i < 100; i++) {
+        vt.insert(std::make_pair(i, i));
+    }
+    PersistentAVLTree<int,int>::Snapshot before = vt.snapshot();
+    vt.remove(50);
+    vt.insert(std::make_pair(7, 700));
+    cout << "\nSnapshot size " << before.size() << ", has 50: " << (before.find(50) != before.end())
+         << ", value at 7: " << before[7] << endl;
+    cout << "Current size " << vt.size() << ", has 50: " << (vt.find(50) != vt.end())
+         << ", value at 7: " << vt[7] << ", balanced: " << vt.isBalanced() << endl;
+
+    // Split and join
+    AVLTree<int,int> low, high;
+    for(int i = 0; i < 100; i++) {
+        low.insert(std::make_pair(i, i));
+    }
+    low.split(60, low, high);
+    cout << "\nSplit at 60: low ends at " << (--low.end())->first << ", high starts at " << high.begin()->first
+         << ", both balanced: " << (low.shape().balanced && high.shape().balanced) << endl;
+    high.remove(60);
+    low.join(low, std::make_pair(60, -60), high);
+    cout << "Joined back: [60] = " << low[60] << ", high empty: " << high.empty()
+         << ", balanced: " << low.shape().balanced << endl;
+
+    // Set algebra
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i < 30; i += 2) {
+        evens.insert(std::make_pair(i, 1));
+    }
+    for(int i = 0; i < 30; i += 3) {
+        threes.insert(std::make_pair(i, 10));
+    }
+    evens.unionWith(threes, [](const int& mine, const int& theirs) { return mine + theirs; }, 2);
+    cout << "\nUnion: [6] = " << evens[6] << ", [9] = " << evens[9] << ", [4] = " << evens[4]
+         << ", other empty: " << threes.empty() << endl;
+    for(int i = 0; i < 30; i += 6) {
+        threes.insert(std::make_pair(i, 0));
+    }
+    evens.differenceWith(threes);
+    cout << "Difference has 12: " << (evens.find(12) != evens.end()) << ", has 9: " << (evens.find(9) != evens.end())
+         << ", balanced: " << evens.shape().balanced << endl;
+
+    // Bulk load from unsorted input
+    std::vector<std::pair<int,int> > dump;
+    for(int i = 0; i < 50; i++) {
+        dump.push_back(std::make_pair((i * 37) % 20, i));
+    }
+    AVLTree<int,int> loaded;
+    loaded.buildFrom(dump.begin(), dump.end(), 2);
+    cout << "\nbuildFrom: first " << loaded.begin()->first << ", last " << (--loaded.end())->first
+         << ", [3] = " << loaded[3] << ", balanced: " << loaded.shape().balanced << endl;
+
+    // Degenerate trees are walked and freed without recursion
+    BinarySearchTree<int,int> chain;
+    for(int i = 0; i < 3000; i++) {
+        chain.insert(chain.end(), std::make_pair(i, i));
+    }
+    BinarySearchTree<int,int>::Shape chainShape = chain.shape();
+    cout << "\nChain balanced: " << chain.isBalanced() << ", height " << chainShape.height
+         << ", max skew " << chainShape.maxSkew << ", last " << (--chain.end())->first;
+    chain.clear();
+    cout << ", cleared: " << chain.empty() << endl;
+
+    BinarySearchTree<int,int>::Shape loadedShape = loaded.shape();
+    cout << "Loaded tree: " << loadedShape.nodes << " nodes, height " << loadedShape.height
+         << ", balanced: " << loadedShape.balanced << endl;
+
+    // Custom comparators
+    AVLTree<int,int,HeapArena,AVLNode<int,int>,std::greater<int> > descending;
+    for(int i = 0; i < 10; i++) {
+        descending.insert(std::make_pair(i, i * i));
+    }
+    descending.remove(9);
+    cout << "\nDescending: first " << descending.begin()->first << ", lower_bound(5) " << descending.lower_bound(5)->first
+         << ", [3] = " << descending[3] << ", balanced: " << descending.shape().balanced << endl;
+    BinarySearchTree<string,int,HeapArena,CaseInsensitive> words;
+    words.insert(std::make_pair(string("Banana"), 1));
+    words.insert(std::make_pair(string("apple"), 2));
+    words.insert(std::make_pair(string("APPLE"), 3));
+    cout << "Case-insensitive: first " << words.begin()->first << " = " << words.begin()->second
+         << ", has BANANA: " << (words.find("BANANA") != words.end()) << endl;
+
+    // Lookups by const char* through a transparent comparator
+    AVLTree<string,int,HeapArena,AVLNode<string,int>,TransparentLess> names;
+    names.insert(std::make_pair(string("carol"), 3));
+    names.insert(std::make_pair(string("alice"), 1));
+    names.insert(std::make_pair(string("bob"), 2));
+    names.remove("bob");
+    cout << "Transparent: [\"carol\"] = " << names["carol"] << ", has bob: " << (names.find("bob") != names.end())
+         << ", lower_bound(\"b\") = " << names.lower_bound("b")->first << endl;
+
+    // Splay trees move each key they touch to the root
+    SplayTree<int,int> splay;
+    SplayTree<int,int> bottomUp(SPLAY_BOTTOM_UP);
+    for(int i = 0; i < 100; i++) {
+        splay.insert(std::make_pair(i, i));
+        bottomUp.insert(std::make_pair(i, i));
+    }
+    splay.find(42);
+    bottomUp[17] = 170;
+    splay.remove(50);
+    bottomUp.remove(50);
+    cout << "\nSplay: find(42) " << splay.find(42)->second << ", has 50: " << (splay.find(50) != splay.end())
+         << ", first " << splay.begin()->first << ", bottom-up [17] = " << bottomUp[17]
+         << ", height " << bottomUp.shape().height << endl;
+
+    // Red-black trees take the same inserts and removes as AVLTree
+    RedBlackTree<int,int> rb;
+    for(int i = 0; i < 100; i++) {
+        rb.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 100; i += 3) {
+        rb.remove(i);
+    }
+    cout << "Red-black: [50] = " << rb[50] << ", has 51: " << (rb.find(51) != rb.end())
+         << ", balanced " << rb.isBalanced() << ", nodes " << rb.shape().nodes
+         << ", height " << rb.shape().height
+         << ", node " << sizeof(RBNode<int,int>) << " bytes (AVL " << sizeof(AVLNode<int,int>) << ")" << endl;
+    RedBlackTree<int,int> rbLoaded;
+    rbLoaded.buildFrom(dump.begin(), dump.end(), 2);
+    cout << "Red-black buildFrom: [3] = " << rbLoaded[3] << ", frozen [3] = " << rbLoaded.freeze()[3]
+         << ", balanced " << rbLoaded.isBalanced() << endl;
+
+    // Operation counters, which only count when built with -DBST_STATS
+    cout << endl;
+    AVLTree<int,int>::dumpStats(cout);
+
     return 0;
 }
@@ -3,22 +3,41 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
+#include <iterator>
 #include <cstdlib>
 #include <utility>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <type_traits>
+#include <tuple>
+#include <vector>
+#include "arena.h"
+#include "opstats.h"
+#include "keycompare.h"
+#include "frozenmap.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are deliberately not
+ * virtual. Subclasses for other kinds of search trees, such
+ * as AVL trees, redefine them to return their own node type,
+ * and each tree only handles its nodes through that type, so
+ * every call resolves at compile time and nodes carry no
+ * vtable pointer.
+ *
+ * When built with BST_THREADED, each node also links to its
+ * in-order neighbours, so iterators step without walking the tree.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... Args>
+    Node(Node<Key, Value>* parent, Args&&... args);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +45,32 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
+
+#ifdef BST_THREADED
+    Node<Key, Value>* getPrev() const;
+    Node<Key, Value>* getNext() const;
+    void setPrev(Node<Key, Value>* prev);
+    void setNext(Node<Key, Value>* next);
+#endif
 
 protected:
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_THREADED
+    Node<Key, Value>* prev_;
+    Node<Key, Value>* next_;
+#endif
 };
 
 /*
@@ -57,6 +88,30 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
     parent_(parent),
     left_(NULL),
     right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
+{
+
+}
+
+/**
+* A constructor that builds the item in place from args, the way
+* std::pair's constructors take them (a pair to copy or move, or
+* std::piecewise_construct and two tuples).
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
 {
 
 }
@@ -118,7 +173,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +182,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +191,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -180,25 +235,82 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A setter for the value of a node that moves from its argument.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
+#ifdef BST_THREADED
+/**
+* A getter for the in-order predecessor.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getPrev() const
+{
+    return prev_;
+}
+
+/**
+* A getter for the in-order successor.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getNext() const
+{
+    return next_;
+}
+
+/**
+* A setter for the in-order predecessor.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setPrev(Node<Key, Value>* prev)
+{
+    prev_ = prev;
+}
+
+/**
+* A setter for the in-order successor.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setNext(Node<Key, Value>* next)
+{
+    next_ = next;
+}
+#endif
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+// Number of lookups findBatch() walks down the tree in lockstep.
+static const std::size_t BST_BATCH_GROUP = 8;
+// Smallest range that sortByKey() will hand half of to another thread.
+static const std::size_t BST_PARALLEL_SORT_MIN = 1 << 15;
+
 /**
 * A templated unbalanced binary search tree.
+* Arena is the node allocation policy, see arena.h. Compare orders the
+* keys, see keycompare.h; it comes after Arena so that trees naming only
+* an arena keep compiling.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Arena = HeapArena, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& compare);
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
-    bool isBalanced() const; //TODO
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    void remove(const K& key);
+    virtual void clear(); //TODO
+    virtual bool isBalanced() const; //TODO
     void print() const;
     bool empty() const;
 
@@ -211,6 +323,12 @@ public:
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,41 +338,199 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Arena, Compare>;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Arena, Compare>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Arena, Compare> *tree_; // Lets end() step back to the largest item
+    };
+
+    /**
+    * The read-only counterpart of iterator. Any iterator converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        iterator it_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    virtual iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Lookups by any type Compare can compare with Key, if it is
+    // transparent (see keycompare.h). No Key is constructed.
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    iterator find(const K& key) const;
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    Value& operator[](const K& key);
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    Value const & operator[](const K& key) const;
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    iterator lower_bound(const K& key) const;
+
+    /**
+    * A pair of iterators that can be walked with a range-based for loop.
+    */
+    class Range
+    {
+    public:
+        Range(const iterator& first, const iterator& last);
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    Range range(const Key& lo, const Key& hi) const;
+    void findBatch(const Key* keys, std::size_t n, iterator* out) const;
+    Compare key_comp() const;
+    FrozenMap<Key, Value, Compare> freeze() const;
+    void freeze(FrozenMap<Key, Value, Compare>& frozen) const;
+    static void dumpStats(std::ostream& out = std::cout);
+
+    /**
+    * What one pass over the tree found out about its shape.
+    */
+    struct Shape
+    {
+        bool balanced;      // No node's subtree heights differ by more than 1
+        int height;         // Nodes on the longest root-to-leaf path
+        std::size_t nodes;
+        int maxSkew;        // Largest subtree height difference at any node
+    };
+    Shape shape() const;
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* internalLocate(const K& key, Node<Key, Value>*& parent, bool& isLeftChild) const;
+    template<typename K>
+    Node<Key, Value>* internalLocate(std::true_type, const K& key, Node<Key, Value>*& parent, bool& isLeftChild) const;
+    template<typename K>
+    Node<Key, Value>* internalLocate(std::false_type, const K& key, Node<Key, Value>*& parent, bool& isLeftChild) const;
+    template<typename K>
+    Node<Key, Value>* internalLowerBound(const K& key) const;
+    virtual void removeNode(Node<Key, Value>* node);
+    void attachNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool isLeftChild);
+    void detachNode(Node<Key, Value>* node);
+    static void linkThreads(Node<Key, Value>* prev, Node<Key, Value>* next);
+    void rethread();
+    Node<Key, Value>* internalLocateHint(const Key& key, const iterator& hint, Node<Key, Value>*& parent, bool& isLeftChild) const;
+    template<typename NodeType, typename Pair>
+    std::pair<NodeType*, bool> insertItem(Pair&& keyValuePair);
+    template<typename NodeType, typename Pair>
+    std::pair<NodeType*, bool> insertItem(const iterator& hint, Pair&& keyValuePair);
+    template<typename NodeType, typename Pair>
+    std::pair<NodeType*, bool> insertAt(Node<Key, Value>* existing, Node<Key, Value>* parent, bool isLeftChild, Pair&& keyValuePair);
+    // What the copying inserts hand to the insert cores: keyValuePair itself when Value
+    // can be copied. Otherwise they are never called, see insert(const&).
+    typedef typename std::conditional<std::is_copy_constructible<Value>::value && std::is_copy_assignable<Value>::value,
+                                      const std::pair<const Key, Value>&, std::pair<const Key, Value>&&>::type CopiedItem;
+    virtual std::pair<iterator, bool> insertCopy(const std::pair<const Key, Value>& keyValuePair);
+    virtual iterator insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    static CopiedItem copiedItem(const std::pair<const Key, Value>& keyValuePair);
+    static CopiedItem copiedItem(std::true_type, const std::pair<const Key, Value>& keyValuePair);
+    static CopiedItem copiedItem(std::false_type, const std::pair<const Key, Value>& keyValuePair);
+    template<typename NodeType, typename... Args>
+    std::pair<NodeType*, bool> emplaceItem(Args&&... args);
+    template<typename NodeType, typename KeyArg, typename... Args>
+    std::pair<NodeType*, bool> tryEmplaceItem(KeyArg&& key, Args&&... args);
+    iterator makeIterator(Node<Key, Value>* node) const;
+    static Node<Key, Value>* getNode(const iterator& it);
     Node<Key, Value> *getSmallestNode(Node<Key, Value>* root) const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2);
+    void printRoot (Node<Key, Value> *r) const;
+    void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2);
     Node<Key, Value> *getLargestNode(Node<Key, Value>* root) const;
     // Add helper functions here
     int getHeight(Node<Key, Value>* root) const;
     static Node<Key, Value>* successor(Node<Key, Value>* current);
-    bool balancedRec(Node<Key, Value>* root) const;
-    void clearHelper(Node<Key, Value>* root);
+    Shape shapeOf(Node<Key, Value>* root) const;
+    template<typename InputIterator>
+    std::vector<std::pair<Key, Value> > sortedItems(InputIterator first, InputIterator last, unsigned threads) const;
+    template<typename RandomIterator>
+    void sortByKey(RandomIterator first, RandomIterator last, unsigned threads) const;
+    template<typename NodeType>
+    void clearNodes();
+    template<typename NodeType>
+    void clearHelper(NodeType* root);
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(NodeType* parent, Args&&... args);
+    template<typename NodeType>
+    void destroyNode(NodeType* node);
 
 protected:
     Node<Key, Value>* root_;
+    // The largest node, or NULL when empty. attachNode and detachNode keep
+    // it, rotations leave it alone, and whatever sets root_ wholesale resets
+    // it, so end() hints and --end() need no walk down the right spine.
+    Node<Key, Value>* largest_;
     // You should not need other data members
+    Arena arena_;
+    KeyCompare<Compare, Key> compare_;
 };
 
 /*
@@ -264,10 +540,13 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the tree it belongs to.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr)
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Arena, Compare>* tree) :
+    current_(ptr),
+    tree_(tree)
 {
     // TODO
 }
@@ -275,8 +554,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::iterator() : current_(NULL), tree_(NULL)
 {
     // TODO
 }
@@ -284,9 +563,9 @@ BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -294,9 +573,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -305,10 +584,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Arena, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ == rhs.current_;
@@ -318,10 +597,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Arena, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ != rhs.current_;
@@ -331,15 +610,57 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator&
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator++()
 {
     // TODO
+#ifdef BST_THREADED
+    current_ = current_->getNext();
+#else
     current_ = successor(current_);
+#endif
+    return *this;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back one item in in-order sequencing.
+* Stepping back from end() lands on the largest item.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator&
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator--()
+{
+    if(current_ == NULL)
+        current_ = tree_->largest_;
+    else {
+#ifdef BST_THREADED
+        current_ = current_->getPrev();
+#else
+        current_ = predecessor(current_);
+#endif
+    }
     return *this;
 }
 
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -347,6 +668,126 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+--------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+--------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::const_iterator()
+{
+
+}
+
+/**
+* Converts a mutable iterator to a read-only one at the same position.
+*/
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::const_iterator(const iterator& it) : it_(it)
+{
+
+}
+
+template<class Key, class Value, class Arena, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator->() const
+{
+    return it_.operator->();
+}
+
+template<class Key, class Value, class Arena, class Compare>
+bool
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return it_ == rhs.it_;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+bool
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return it_ != rhs.it_;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++it_;
+    return old;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator--()
+{
+    --it_;
+    return *this;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --it_;
+    return old;
+}
+
+/*
+------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+/**
+* A range over [first, last), where last must be reachable from first.
+*/
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::Range::Range(const iterator& first, const iterator& last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::Range::begin() const
+{
+    return first_;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::Range::end() const
+{
+    return last_;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+bool BinarySearchTree<Key, Value, Arena, Compare>::Range::empty() const
+{
+    return first_ == last_;
+}
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -356,15 +797,24 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(NULL)
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::BinarySearchTree() : root_(NULL), largest_(NULL)
 {
     // TODO
 
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructs an empty tree that orders its keys with compare.
+*/
+template<class Key, class Value, class Arena, class Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::BinarySearchTree(const Compare& compare) : root_(NULL), largest_(NULL), compare_(compare)
+{
+
+}
+
+template<typename Key, typename Value, typename Arena, typename Compare>
+BinarySearchTree<Key, Value, Arena, Compare>::~BinarySearchTree()
 {
     // TODO
     clear();
@@ -373,14 +823,14 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Arena, class Compare>
+bool BinarySearchTree<Key, Value, Arena, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Arena, typename Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -389,51 +839,338 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode(root_));
+    BinarySearchTree<Key, Value, Arena, Compare>::iterator begin(getSmallestNode(root_), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Arena, Compare>::iterator end(NULL, this);
     return end;
 }
 
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::cbegin() const
+{
+    return const_iterator(begin());
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::cend() const
+{
+    return const_iterator(end());
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree.
+* Reverse iteration walks predecessors, so the last n items cost O(log n + n).
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Arena, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Arena, Compare>::iterator it(curr, this);
     return it;
 }
 
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::find(const K & k) const
+{
+    return iterator(internalFind(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::lower_bound(const Key & key) const
+{
+    return iterator(internalLowerBound(key), this);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::lower_bound(const K & key) const
+{
+    return iterator(internalLowerBound(key), this);
+}
+
+/**
+* The node lower_bound() stops at, or NULL.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalLowerBound(const K & key) const
+{
+    Node<Key, Value> *best = NULL;
+    Node<Key, Value> *temp = root_;
+    BST_STAT(STAT_SEARCHES, 1);
+    while(temp != NULL){
+        BST_STAT(STAT_NODES_VISITED, 1);
+        if(compare_.less(temp->getKey(), key)) // Too small, everything on the left is too
+            temp = temp->getRight();
+        else { // A candidate, but there may be a smaller one on the left
+            best = temp;
+            temp = temp->getLeft();
+        }
+    }
+    return best;
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::upper_bound(const Key & key) const
+{
+    Node<Key, Value> *best = NULL;
+    Node<Key, Value> *temp = root_;
+    BST_STAT(STAT_SEARCHES, 1);
+    while(temp != NULL){
+        BST_STAT(STAT_NODES_VISITED, 1);
+        if(compare_.less(key, temp->getKey())){ // A candidate, but there may be a smaller one on the left
+            best = temp;
+            temp = temp->getLeft();
+        } else // Too small, everything on the left is too
+            temp = temp->getRight();
+    }
+    return iterator(best, this);
+}
+
+/**
+* Returns the items with the given key as [first, second), which holds
+* one item or none.
+*/
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, typename BinarySearchTree<Key, Value, Arena, Compare>::iterator>
+BinarySearchTree<Key, Value, Arena, Compare>::equal_range(const Key & key) const
+{
+    iterator first = lower_bound(key);
+    iterator last = first;
+    if(first != end() && !compare_.less(key, first->first)) // Found key, the range ends just after it
+        ++last;
+    return std::make_pair(first, last);
+}
+
+/**
+* Returns an iterator to the item with the largest key not greater than
+* key, or end() if there is none.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::floor(const Key & key) const
+{
+    Node<Key, Value> *best = NULL;
+    Node<Key, Value> *temp = root_;
+    BST_STAT(STAT_SEARCHES, 1);
+    while(temp != NULL){
+        BST_STAT(STAT_NODES_VISITED, 1);
+        if(compare_.less(key, temp->getKey())) // Too big, everything on the right is too
+            temp = temp->getLeft();
+        else { // A candidate, but there may be a bigger one on the right
+            best = temp;
+            temp = temp->getRight();
+        }
+    }
+    return iterator(best, this);
+}
+
+/**
+* Returns an iterator to the item with the smallest key not less than
+* key, or end() if there is none. The same as lower_bound.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::ceiling(const Key & key) const
+{
+    return lower_bound(key);
+}
+
+/**
+* Returns the items with keys in [lo, hi). Finding the start is one
+* descent; walking the k items in it costs O(k).
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::Range
+BinarySearchTree<Key, Value, Arena, Compare>::range(const Key & lo, const Key & hi) const
+{
+    if(!compare_.less(lo, hi))
+        return Range(end(), end());
+    return Range(lower_bound(lo), lower_bound(hi));
+}
+
+/**
+* Looks up keys[0..n) and stores an iterator to each one's item, or end(),
+* in out[0..n). The lookups go down the tree BST_BATCH_GROUP at a time,
+* one level per round, prefetching each lane's next node. The cache
+* misses of a whole group then overlap instead of stalling one by one.
+* Each lane goes to a leaf like lower_bound, one comparison per level,
+* then checks its candidate for equality.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::findBatch(const Key* keys, std::size_t n, iterator* out) const
+{
+    Node<Key, Value>* lanes[BST_BATCH_GROUP];
+    Node<Key, Value>* bounds[BST_BATCH_GROUP];
+    for(std::size_t base = 0; base < n; base += BST_BATCH_GROUP){
+        std::size_t group = n - base < BST_BATCH_GROUP ? n - base : BST_BATCH_GROUP;
+        for(std::size_t j = 0; j < group; ++j){
+            lanes[j] = root_;
+            bounds[j] = NULL;
+            out[base + j] = end();
+        }
+        BST_STAT(STAT_SEARCHES, group);
+        std::size_t active = group;
+        while(active > 0){
+            active = 0;
+            for(std::size_t j = 0; j < group; ++j){
+                Node<Key, Value>* temp = lanes[j];
+                if(temp == NULL) // This lane is finished
+                    continue;
+                const Key& key = keys[base + j];
+                BST_STAT(STAT_NODES_VISITED, 1);
+                if(compare_.less(temp->getKey(), key))
+                    temp = temp->getRight();
+                else { // The smallest key not less than key so far
+                    bounds[j] = temp;
+                    temp = temp->getLeft();
+                }
+                lanes[j] = temp;
+                if(temp != NULL){
+#if defined(__GNUC__)
+                    __builtin_prefetch(temp);
+#endif
+                    ++active;
+                }
+            }
+        }
+        for(std::size_t j = 0; j < group; ++j){
+            if(bounds[j] != NULL && !compare_.less(keys[base + j], bounds[j]->getKey())) // Found key
+                out[base + j] = iterator(bounds[j], this);
+        }
+    }
+}
+
+/**
+* Returns a copy of the comparator the tree orders its keys with.
+*/
+template<class Key, class Value, class Arena, class Compare>
+Compare BinarySearchTree<Key, Value, Arena, Compare>::key_comp() const
+{
+    return compare_.get();
+}
+
+/**
+* Returns a read-only copy of the tree laid out for fast lookups.
+*/
+template<class Key, class Value, class Arena, class Compare>
+FrozenMap<Key, Value, Compare> BinarySearchTree<Key, Value, Arena, Compare>::freeze() const
+{
+    FrozenMap<Key, Value, Compare> frozen(key_comp());
+    freeze(frozen);
+    return frozen;
+}
+
+/**
+* Refreezes an existing copy after a batch of updates, in O(n) and
+* reusing the copy's storage.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::freeze(FrozenMap<Key, Value, Compare>& frozen) const
+{
+    frozen.assignSorted(begin(), end());
+}
+
+/**
+* Writes the operation counters of every tree in the process to out. They
+* only count with BST_STATS defined; see opstats.h.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::dumpStats(std::ostream& out)
+{
+    ::dumpStats(out);
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Arena, class Compare>
+Value& BinarySearchTree<Key, Value, Arena, Compare>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Arena, class Compare>
+Value const & BinarySearchTree<Key, Value, Arena, Compare>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+Value& BinarySearchTree<Key, Value, Arena, Compare>::operator[](const K& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+Value const & BinarySearchTree<Key, Value, Arena, Compare>::operator[](const K& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -445,47 +1182,334 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
+* Returns an iterator to the item and whether it was newly added.
+*
+* It isn't virtual, so it is only compiled where it is called, and a
+* move-only Value fails to compile here instead of failing at runtime.
+* Subclasses override insertCopy instead, which builds the node straight
+* from keyValuePair, so the key is copied once for a new item and not at
+* all for an overwrite.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
     // TODO
-    if(root_ == NULL){
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-        return;
+    static_assert(std::is_copy_constructible<Value>::value, "Value can't be copied, insert it by move instead");
+    return insertCopy(keyValuePair);
+}
+
+/**
+* Same as above, but moves the value out of keyValuePair instead of copying it.
+*/
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::insert(std::pair<const Key, Value> &&keyValuePair)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertItem<Node<Key, Value> >(std::move(keyValuePair));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Inserts like insert(keyValuePair), but first tries the position given by
+* hint, as std::map does: the item belongs just before hint, or just after
+* it. A correct hint costs O(1) comparisons, so appending in key order
+* with end() (or the last inserted item) as the hint skips the descent
+* from the root. A wrong hint falls back to a normal insert.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::insert(iterator hint, const std::pair<const Key, Value> &keyValuePair)
+{
+    static_assert(std::is_copy_constructible<Value>::value, "Value can't be copied, insert it by move instead");
+    return insertCopy(hint, keyValuePair);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::insert(iterator hint, std::pair<const Key, Value> &&keyValuePair)
+{
+    return iterator(insertItem<Node<Key, Value> >(hint, std::move(keyValuePair)).first, this);
+}
+
+/**
+* Builds the item from args directly inside a new node, then inserts it
+* like insert(), so an existing key has its value overwritten (by move).
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = emplaceItem<Node<Key, Value> >(std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* If key is not in the tree, adds it with a value built in place from args.
+* If it is, nothing is built and the existing value is left alone.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceItem<Node<Key, Value> >(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceItem<Node<Key, Value> >(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Insert core shared with subclasses: one descent, then either overwrite
+* the existing value or link in a new NodeType built from keyValuePair.
+* Returns the node and whether it is new, so callers can rebalance.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename NodeType, typename Pair>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Arena, Compare>::insertItem(Pair&& keyValuePair)
+{
+    Node<Key, Value>* parent;
+    bool isLeftChild;
+    Node<Key, Value>* existing = internalLocate(keyValuePair.first, parent, isLeftChild);
+    return insertAt<NodeType>(existing, parent, isLeftChild, std::forward<Pair>(keyValuePair));
+}
+
+/**
+* Same as above, but finds the spot starting from hint.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename NodeType, typename Pair>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Arena, Compare>::insertItem(const iterator& hint, Pair&& keyValuePair)
+{
+    Node<Key, Value>* parent;
+    bool isLeftChild;
+    Node<Key, Value>* existing = internalLocateHint(keyValuePair.first, hint, parent, isLeftChild);
+    return insertAt<NodeType>(existing, parent, isLeftChild, std::forward<Pair>(keyValuePair));
+}
+
+/**
+* Finishes an insert once the key has been located.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename NodeType, typename Pair>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Arena, Compare>::insertAt(Node<Key, Value>* existing, Node<Key, Value>* parent,
+                                                                       bool isLeftChild, Pair&& keyValuePair)
+{
+    if(existing != NULL){
+        existing->setValue(std::forward<Pair>(keyValuePair).second);
+        return std::make_pair(static_cast<NodeType*>(existing), false);
     }
-    //If root is not NULL
-    Node<Key, Value> *temp = root_;
-    bool overwrite = false;
-    bool isLeftChild = false;
-    while(true){
-        if(keyValuePair.first < temp->getKey()){
-            if(temp->getLeft() == NULL){ //If we are going off the end, make note of direction and stop
-                isLeftChild = true;
-                break;
-            }
-            temp = temp->getLeft();
-        } else if(keyValuePair.first > temp->getKey()) {
-            if(temp->getRight() == NULL){ //If we are going off the end, make note of direction and stop
-                isLeftChild = false;
-                break;
-            }
-            temp = temp->getRight();
-        } else{ //If key exists already
-            overwrite = true;
-            break;
-        }
+    NodeType* node = createNode(static_cast<NodeType*>(parent), std::forward<Pair>(keyValuePair));
+    attachNode(node, parent, isLeftChild);
+    return std::make_pair(node, true);
+}
+
+/**
+* The virtual half of insert(const&).
+*/
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Arena, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Arena, Compare>::insertCopy(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertItem<Node<Key, Value> >(copiedItem(keyValuePair));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    return iterator(insertItem<Node<Key, Value> >(hint, copiedItem(keyValuePair)).first, this);
+}
+
+/**
+* insertCopy is virtual, so it gets compiled even for move-only values.
+* This hands it keyValuePair when Value can be copied. The other overload
+* only has to compile, since the static_assert in insert(const&) keeps it
+* from ever being called.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::CopiedItem
+BinarySearchTree<Key, Value, Arena, Compare>::copiedItem(const std::pair<const Key, Value>& keyValuePair)
+{
+    return copiedItem(std::integral_constant<bool,
+        std::is_copy_constructible<Value>::value && std::is_copy_assignable<Value>::value>(), keyValuePair);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::CopiedItem
+BinarySearchTree<Key, Value, Arena, Compare>::copiedItem(std::true_type, const std::pair<const Key, Value>& keyValuePair)
+{
+    return keyValuePair;
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::CopiedItem
+BinarySearchTree<Key, Value, Arena, Compare>::copiedItem(std::false_type, const std::pair<const Key, Value>&)
+{
+    throw std::logic_error("Value can't be copied, insert it by move instead");
+}
+
+/**
+* Emplace core. The key is only known once the item is built, so the
+* node comes first; if the key turns out to exist its value is moved over.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename NodeType, typename... Args>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Arena, Compare>::emplaceItem(Args&&... args)
+{
+    NodeType* node = createNode(static_cast<NodeType*>(NULL), std::forward<Args>(args)...);
+    Node<Key, Value>* parent;
+    bool isLeftChild;
+    Node<Key, Value>* existing = internalLocate(node->getKey(), parent, isLeftChild);
+    if(existing != NULL){
+        existing->setValue(std::move(node->getValue()));
+        destroyNode(node);
+        return std::make_pair(static_cast<NodeType*>(existing), false);
     }
+    node->setParent(parent);
+    attachNode(node, parent, isLeftChild);
+    return std::make_pair(node, true);
+}
+
+/**
+* try_emplace core: the value is only constructed once the key is known to be absent.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename NodeType, typename KeyArg, typename... Args>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Arena, Compare>::tryEmplaceItem(KeyArg&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool isLeftChild;
+    Node<Key, Value>* existing = internalLocate(key, parent, isLeftChild);
+    if(existing != NULL)
+        return std::make_pair(static_cast<NodeType*>(existing), false);
+    NodeType* node = createNode(static_cast<NodeType*>(parent), std::piecewise_construct,
+                                std::forward_as_tuple(std::forward<KeyArg>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+    attachNode(node, parent, isLeftChild);
+    return std::make_pair(node, true);
+}
 
-    // Modify values as instructed
-    if(overwrite)
-        temp->setValue(keyValuePair.second);
-    else{
-        if(isLeftChild)
-            temp->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, temp));
-        else
-            temp->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, temp));
+/**
+* Links a node made for the spot internalLocate() reported.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::attachNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool isLeftChild)
+{
+    if(parent == NULL)
+        root_ = node;
+    else if(isLeftChild)
+        parent->setLeft(node);
+    else
+        parent->setRight(node);
+    if(parent == NULL || (parent == largest_ && !isLeftChild))
+        largest_ = node;
+#ifdef BST_THREADED
+    // A new leaf sits right next to its parent in order
+    if(parent != NULL){
+        Node<Key, Value>* prev = isLeftChild ? parent->getPrev() : parent;
+        Node<Key, Value>* next = isLeftChild ? parent : parent->getNext();
+        node->setPrev(prev);
+        node->setNext(next);
+        if(prev != NULL)
+            prev->setNext(node);
+        if(next != NULL)
+            next->setPrev(node);
     }
+#endif
+}
+
+/**
+* Drops a node that is about to be destroyed from the in-order links and,
+* if it was the largest, hands that role to its predecessor. Call it once
+* node is unlinked but still has its own parent and left pointers: the
+* largest node has no right child, so whatever took its place came from
+* its left, or else its parent is next largest. Rotations and nodeSwap
+* never change which nodes are neighbours by key, so this is the only
+* place the links shrink.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::detachNode(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    if(node == largest_)
+        largest_ = node->getPrev();
+    if(node->getPrev() != NULL)
+        node->getPrev()->setNext(node->getNext());
+    if(node->getNext() != NULL)
+        node->getNext()->setPrev(node->getPrev());
+#else
+    if(node == largest_)
+        largest_ = node->getLeft() != NULL ? getLargestNode(node->getLeft()) : node->getParent();
+#endif
+}
+
+/**
+* Makes prev and next in-order neighbours, where either may be NULL to
+* mark the end of a tree. A no-op unless BST_THREADED.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::linkThreads(Node<Key, Value>* prev, Node<Key, Value>* next)
+{
+#ifdef BST_THREADED
+    if(prev != NULL)
+        prev->setNext(next);
+    if(next != NULL)
+        next->setPrev(prev);
+#else
+    (void)prev;
+    (void)next;
+#endif
+}
+
+/**
+* Finds the largest node again and, when BST_THREADED, rebuilds every
+* in-order link with one walk, for trees that were built without going
+* through attachNode.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::rethread()
+{
+    largest_ = getLargestNode(root_);
+#ifdef BST_THREADED
+    Node<Key, Value>* prev = NULL;
+    for(Node<Key, Value>* curr = getSmallestNode(root_); curr != NULL; curr = successor(curr)){
+        curr->setPrev(prev);
+        if(prev != NULL)
+            prev->setNext(curr);
+        prev = curr;
+    }
+    if(prev != NULL)
+        prev->setNext(NULL);
+#endif
+}
+
+/**
+* Unwraps the node from an iterator, for subclasses that can't reach it.
+*/
+template<class Key, class Value, class Arena, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::getNode(const iterator& it)
+{
+    return it.current_;
+}
+
+/**
+* Wraps a node in an iterator, for subclasses that can't reach the constructor.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::iterator
+BinarySearchTree<Key, Value, Arena, Compare>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
 }
 
 
@@ -494,86 +1518,99 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Arena, typename Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::remove(const Key& key)
 {
     // TODO
     if(root_ == NULL){
         return;
     }
     //If root is not NULL
-    Node<Key, Value> *temp = root_;
-    while(temp != NULL){
-        if(key > temp->getKey()) // If key is greater than current node, go right
-            temp = temp->getRight();
-        else if (key < temp->getKey())
-            temp = temp->getLeft(); // If key is less than current node, go left
-        else { // We found the node
-            if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
-                if(temp->getParent() == NULL) // If no parent, set root to NULL, then delete
-                    root_ = NULL;
-                else if(temp->getParent()->getRight() == temp) //If is right child, set parent's right child to NULL
-                    temp->getParent()->setRight(NULL);
-                else // Else if is left child, set parent's left child to NULL
-                    temp->getParent()->setLeft(NULL);
-            } else if(temp->getLeft() == NULL && temp->getRight() != NULL){ // Has right child only, promote child then delete
-                if(temp->getParent() != NULL){ // If has parent
-                    if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's right
-                        temp->getParent()->setRight(temp->getRight());
-                    else // Else if temp is left child, set parent's left child to temp's right
-                        temp->getParent()->setLeft(temp->getRight());
-                    temp->getRight()->setParent(temp->getParent()); //Set child's parent to temp's parent
-                } else { // If no parent, set root to child, then delete
-                    root_ = temp->getRight();
-                    root_->setParent(NULL);
-                }
-            } else if(temp->getLeft() != NULL && temp->getRight() == NULL){ // Has left child only, promote child then delete
-                if(temp->getParent() != NULL){ // If has parent
-                    if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's left
-                        temp->getParent()->setRight(temp->getLeft());
-                    else // Else if temp is left child, set parent's left child to temp's left
-                        temp->getParent()->setLeft(temp->getLeft());
-                    temp->getLeft()->setParent(temp->getParent()); //Set child's parent to temp's parent
-                } else { // If no parent, set root to child, then delete
-                    root_ = temp->getLeft();
-                    root_->setParent(NULL);
-                }
-            } else { // Has both children, swap with predecessor then delete
-                nodeSwap(temp, predecessor(temp));
-                if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
-                    if(temp->getParent()->getRight() == temp) //If is right child, set parent's right child to NULL
-                        temp->getParent()->setRight(NULL);
-                    else // Else if is left child, set parent's left child to NULL
-                        temp->getParent()->setLeft(NULL);
-                } else { //We know it only has one child
-                    bool hasLeftChild = temp->getLeft() != NULL;
-                    if(hasLeftChild) {
-                        if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's left
-                            temp->getParent()->setRight(temp->getLeft());
-                        else // Else if temp is left child, set parent's left child to temp's left
-                            temp->getParent()->setLeft(temp->getLeft());
-                        temp->getLeft()->setParent(temp->getParent()); //Set child's parent to temp's parent
-                    } else {
-                        if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's right
-                            temp->getParent()->setRight(temp->getRight());
-                        else // Else if temp is left child, set parent's left child to temp's right
-                            temp->getParent()->setLeft(temp->getRight());
-                        temp->getRight()->setParent(temp->getParent()); //Set child's parent to temp's parent
-                    }
-                }
+    Node<Key, Value> *temp = internalFind(key);
+    if(temp != NULL)
+        removeNode(temp);
+    // Else we didn't find the node
+}
+
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename K, typename>
+void BinarySearchTree<Key, Value, Arena, Compare>::remove(const K& key)
+{
+    Node<Key, Value> *temp = internalFind(key);
+    if(temp != NULL)
+        removeNode(temp);
+}
+
+/**
+* Unlinks temp, a node of this tree, and frees it. The remove overloads
+* share it once they have found the node; subclasses override it to
+* rebalance.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::removeNode(Node<Key, Value>* temp)
+{
+    if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
+        if(temp->getParent() == NULL) // If no parent, set root to NULL, then delete
+            root_ = NULL;
+        else if(temp->getParent()->getRight() == temp) //If is right child, set parent's right child to NULL
+            temp->getParent()->setRight(NULL);
+        else // Else if is left child, set parent's left child to NULL
+            temp->getParent()->setLeft(NULL);
+    } else if(temp->getLeft() == NULL && temp->getRight() != NULL){ // Has right child only, promote child then delete
+        if(temp->getParent() != NULL){ // If has parent
+            if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's right
+                temp->getParent()->setRight(temp->getRight());
+            else // Else if temp is left child, set parent's left child to temp's right
+                temp->getParent()->setLeft(temp->getRight());
+            temp->getRight()->setParent(temp->getParent()); //Set child's parent to temp's parent
+        } else { // If no parent, set root to child, then delete
+            root_ = temp->getRight();
+            root_->setParent(NULL);
+        }
+    } else if(temp->getLeft() != NULL && temp->getRight() == NULL){ // Has left child only, promote child then delete
+        if(temp->getParent() != NULL){ // If has parent
+            if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's left
+                temp->getParent()->setRight(temp->getLeft());
+            else // Else if temp is left child, set parent's left child to temp's left
+                temp->getParent()->setLeft(temp->getLeft());
+            temp->getLeft()->setParent(temp->getParent()); //Set child's parent to temp's parent
+        } else { // If no parent, set root to child, then delete
+            root_ = temp->getLeft();
+            root_->setParent(NULL);
+        }
+    } else { // Has both children, swap with predecessor then delete
+        nodeSwap(temp, predecessor(temp));
+        if(temp->getLeft() == NULL && temp->getRight() == NULL){ // Has no children, set parent's child pointer to NULL, delete
+            if(temp->getParent()->getRight() == temp) //If is right child, set parent's right child to NULL
+                temp->getParent()->setRight(NULL);
+            else // Else if is left child, set parent's left child to NULL
+                temp->getParent()->setLeft(NULL);
+        } else { //We know it only has one child
+            bool hasLeftChild = temp->getLeft() != NULL;
+            if(hasLeftChild) {
+                if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's left
+                    temp->getParent()->setRight(temp->getLeft());
+                else // Else if temp is left child, set parent's left child to temp's left
+                    temp->getParent()->setLeft(temp->getLeft());
+                temp->getLeft()->setParent(temp->getParent()); //Set child's parent to temp's parent
+            } else {
+                if(temp->getParent()->getRight() == temp) //If temp is right child, set parent's right child to temp's right
+                    temp->getParent()->setRight(temp->getRight());
+                else // Else if temp is left child, set parent's left child to temp's right
+                    temp->getParent()->setLeft(temp->getRight());
+                temp->getRight()->setParent(temp->getParent()); //Set child's parent to temp's parent
             }
-            delete temp;
-            break;
         }
     }
-    // We didn't find the node
+    detachNode(temp);
+    destroyNode(temp);
 }
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Arena, Compare>::predecessor(Node<Key, Value>* current)
 {
     // TODO
     if(current->getLeft() != NULL){ // Need to find the largest node in left subtree
@@ -581,16 +1618,19 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
         while(temp->getRight() != NULL) { temp = temp->getRight(); }
         return temp;
     }
-    //If no left child need to check if this is a right or left child
-    if(current->getParent()->getLeft() == current) // If left child, then return NULL
-        return NULL;
-    else 
-        return current->getParent(); // If right child, return parent
+    //If no left child, walk up until we come from a right child; that parent is next smallest
+    Node<Key, Value> *child = current;
+    Node<Key, Value> *parent = current->getParent();
+    while(parent != NULL && parent->getLeft() == child){
+        child = parent;
+        parent = parent->getParent();
+    }
+    return parent; // NULL if current was the smallest
 }
 
-template<class Key, class Value>
+template<class Key, class Value, class Arena, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current) {
+BinarySearchTree<Key, Value, Arena, Compare>::successor(Node<Key, Value>* current) {
     if(current == NULL)
         return NULL;
     if(current->getRight() != NULL){ // Need to find the smallest node in right subtree
@@ -598,64 +1638,118 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current) {
         while(temp->getLeft() != NULL) { temp = temp->getLeft(); }
         return temp;
     }
-    if(current->getParent() == NULL) //If no right child and no parent, return null
-        return NULL;
-    //If no right child need to check if this is a right or left child
-    if(current->getParent()->getRight() == current) // If right child, then return NULL
-        return NULL;
-    else
-        return current->getParent(); // If left child, return parent
+    //If no right child, walk up until we come from a left child; that parent is next largest
+    Node<Key, Value> *child = current;
+    Node<Key, Value> *parent = current->getParent();
+    while(parent != NULL && parent->getRight() == child){
+        child = parent;
+        parent = parent->getParent();
+    }
+    return parent; // NULL if current was the largest
 }
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Arena, typename Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::clear()
 {
     // TODO
-    clearHelper(root_);
+    clearNodes<Node<Key, Value> >();
+}
+
+/**
+* Frees every node, treating them all as NodeType. Subclasses with their
+* own node type override clear() to call this with that type.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Arena, Compare>::clearNodes()
+{
+    // With a bulk-release arena and no item to destruct, the slabs can simply be dropped
+    if(!Arena::bulkRelease || !std::is_trivially_destructible<std::pair<const Key, Value> >::value)
+        clearHelper(static_cast<NodeType*>(root_));
     root_= NULL;
+    largest_ = NULL;
+    arena_.release();
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* root) 
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Arena, Compare>::clearHelper(NodeType* root)
 {
-    if(root == NULL)
-        return;
-    // Postorder walk
-    clearHelper(root->getLeft());
-    clearHelper(root->getRight());
-    delete root;
+    // Rotate left children up until root has none, then free it and move
+    // right. Each rotation puts one more node on the right spine, so this
+    // is linear time, and it needs no stack however deep the tree is.
+    while(root != NULL){
+        NodeType* left = root->getLeft();
+        if(left != NULL){
+            root->setLeft(left->getRight());
+            left->setRight(root);
+            root = left;
+        } else {
+            NodeType* right = root->getRight();
+            destroyNode(root);
+            root = right;
+        }
+    }
+}
+
+/**
+* Constructs a node of the given type in storage from the arena,
+* forwarding args on to build its item.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Arena, Compare>::createNode(NodeType* parent, Args&&... args)
+{
+    void* block = arena_.allocate(sizeof(NodeType));
+    try {
+        return new (block) NodeType(parent, std::forward<Args>(args)...);
+    } catch(...) {
+        arena_.deallocate(block);
+        throw;
+    }
+}
+
+/**
+* Destroys a node made by createNode and hands its storage back to the arena.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Arena, Compare>::destroyNode(NodeType* node)
+{
+    node->~NodeType();
+    arena_.deallocate(node);
 }
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Arena, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode(Node<Key, Value>* root) const
+BinarySearchTree<Key, Value, Arena, Compare>::getSmallestNode(Node<Key, Value>* root) const
 {
     // TODO
     // Go as left as possible
     if(root == NULL)
         return NULL;
-    if(root->getLeft() == NULL)
-        return root;
-    return getSmallestNode(root->getLeft());
+    while(root->getLeft() != NULL)
+        root = root->getLeft();
+    return root;
 }
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Arena, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getLargestNode(Node<Key, Value>* root) const
+BinarySearchTree<Key, Value, Arena, Compare>::getLargestNode(Node<Key, Value>* root) const
 {
     // Go as right as possible
     if(root == NULL)
         return NULL;
-    if(root->getRight() == NULL)
-        return root;
-    return getLargestNode(root->getRight());
+    while(root->getRight() != NULL)
+        root = root->getRight();
+    return root;
 }
 
 /**
@@ -663,51 +1757,269 @@ BinarySearchTree<Key, Value>::getLargestNode(Node<Key, Value>* root) const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalFind(const K& key) const
 {
     // TODO
-    if(root_ == NULL)
-        return NULL;
+    Node<Key, Value> *parent;
+    bool isLeftChild;
+    return internalLocate(key, parent, isLeftChild);
+}
+
+/**
+* Single descent shared by find, remove and the insert family. Returns the
+* node with the given key, or NULL with parent and isLeftChild set to where
+* a node with that key would be attached (parent is NULL for an empty
+* tree). Makes one comparison per node, see the two overloads below.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalLocate(const K& key, Node<Key, Value>*& parent, bool& isLeftChild) const
+{
+    parent = NULL;
+    isLeftChild = false;
+    BST_STAT(STAT_SEARCHES, 1);
+    return internalLocate(std::integral_constant<bool, KeyCompare<Compare, Key>::threeWay>(), key, parent, isLeftChild);
+}
+
+//With a three-way comparator, one call per node tells all three cases
+//apart, so the descent stops as soon as it meets the key.
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalLocate(std::true_type, const K& key,
+                                                                     Node<Key, Value>*& parent, bool& isLeftChild) const
+{
     Node<Key, Value> *temp = root_;
     while(temp != NULL){
-        if(key > temp->getKey()) // Key is bigger than current node, go right
-            temp = temp->getRight();
-        else if(key < temp->getKey()) // Key is smaller than current node, go right
+        BST_STAT(STAT_NODES_VISITED, 1);
+        int order = compare_.order(key, temp->getKey());
+        if(order < 0){ // Key is smaller than current node, go left
+            parent = temp;
+            isLeftChild = true;
             temp = temp->getLeft();
-        else // Found key
+        } else if(order > 0){ // Key is bigger than current node, go right
+            parent = temp;
+            isLeftChild = false;
+            temp = temp->getRight();
+        } else // Found key
             return temp;
     }
-    return NULL; //Recursed off the end
+    return NULL;
+}
+
+//With only less-than, asking both "smaller?" and "bigger?" would take two
+//calls per node. Instead go to a leaf like lower_bound, one call per node,
+//remembering the last node that was not smaller than key. Only that node
+//can hold key, and one more call at the end tells whether it does.
+template<typename Key, typename Value, typename Arena, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalLocate(std::false_type, const K& key,
+                                                                     Node<Key, Value>*& parent, bool& isLeftChild) const
+{
+    Node<Key, Value> *bound = NULL;
+    Node<Key, Value> *temp = root_;
+    while(temp != NULL){
+        BST_STAT(STAT_NODES_VISITED, 1);
+        parent = temp;
+        if(compare_.less(temp->getKey(), key)){ // Key is bigger than current node, go right
+            isLeftChild = false;
+            temp = temp->getRight();
+        } else { // Key is not bigger, so it is here or on the left
+            bound = temp;
+            isLeftChild = true;
+            temp = temp->getLeft();
+        }
+    }
+    if(bound != NULL && !compare_.less(key, bound->getKey())) // Found key
+        return bound;
+    return NULL;
+}
+
+/**
+* Like internalLocate, but first checks whether key belongs right next to
+* hint: between hint's predecessor and hint, or between hint and its
+* successor. Either check takes at most two comparisons. Only when key
+* fits neither does it fall back to a descent from the root. The end()
+* hint and the largest node need no walk to find their neighbours, and
+* with BST_THREADED no hint does, so appending in order is O(1) whether
+* the hint is end() or the last item inserted.
+*/
+template<typename Key, typename Value, typename Arena, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Arena, Compare>::internalLocateHint(const Key& key, const iterator& hint,
+                                                                         Node<Key, Value>*& parent, bool& isLeftChild) const
+{
+    Node<Key, Value> *next = hint.current_;
+    parent = NULL;
+    isLeftChild = false;
+    if(root_ == NULL)
+        return internalLocate(key, parent, isLeftChild);
+    if(next == NULL || compare_.less(key, next->getKey())){ // Key may belong just before hint
+#ifdef BST_THREADED
+        Node<Key, Value> *prev = (next == NULL) ? largest_ : next->getPrev();
+#else
+        Node<Key, Value> *prev = (next == NULL) ? largest_ : predecessor(next);
+#endif
+        if(prev == NULL || compare_.less(prev->getKey(), key)){
+            // The gap between prev and next is either next's empty left or prev's empty right
+            if(next != NULL && next->getLeft() == NULL){
+                parent = next;
+                isLeftChild = true;
+            } else {
+                parent = prev;
+                isLeftChild = false;
+            }
+            return NULL;
+        }
+        if(!compare_.less(key, prev->getKey())) // Key is prev's
+            return prev;
+    } else if(compare_.less(next->getKey(), key)){ // Key may belong just after hint
+#ifdef BST_THREADED
+        Node<Key, Value> *after = next->getNext();
+#else
+        Node<Key, Value> *after = (next == largest_) ? NULL : successor(next);
+#endif
+        if(after == NULL || compare_.less(key, after->getKey())){
+            if(next->getRight() == NULL){
+                parent = next;
+                isLeftChild = false;
+            } else {
+                parent = after;
+                isLeftChild = true;
+            }
+            return NULL;
+        }
+        if(!compare_.less(after->getKey(), key)) // Key is after's
+            return after;
+    } else // Key is hint's
+        return next;
+    return internalLocate(key, parent, isLeftChild);
 }
 
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Arena, typename Compare>
+bool BinarySearchTree<Key, Value, Arena, Compare>::isBalanced() const
 {
     // TODO
-    return balancedRec(root_);
+    return shapeOf(root_).balanced;
 }
 
-//Recursive function that determines the balance of a tree rooted at root
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balancedRec(Node<Key, Value>* root) const
+/**
+ * Returns the balance, height, size and worst skew of the tree, in O(n).
+ */
+template<typename Key, typename Value, typename Arena, typename Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::Shape
+BinarySearchTree<Key, Value, Arena, Compare>::shape() const
 {
+    return shapeOf(root_);
+}
+
+//Measures the subtree at root with one postorder walk, O(n). The walk
+//follows parent pointers, so the only extra space is the heights of the
+//finished subtrees still waiting on their parent, O(height) of it.
+template<typename Key, typename Value, typename Arena, typename Compare>
+typename BinarySearchTree<Key, Value, Arena, Compare>::Shape
+BinarySearchTree<Key, Value, Arena, Compare>::shapeOf(Node<Key, Value>* root) const
+{
+    Shape shape = { true, 0, 0, 0 };
     if(root == NULL)
-        return true;
-    if(abs(getHeight(root->getLeft()) - getHeight(root->getRight())) <= 1) // If subtree height is within 1, root is balanced, need to check next level down
-        return balancedRec(root->getLeft()) && balancedRec(root->getRight());
-    return false;
+        return shape;
+    std::vector<int> heights;
+    Node<Key, Value>* stop = root->getParent();
+    Node<Key, Value>* prev = stop;
+    Node<Key, Value>* curr = root;
+    while(curr != stop){
+        Node<Key, Value>* next;
+        if(prev == curr->getParent() && curr->getLeft() != NULL) // Coming down, do the left subtree
+            next = curr->getLeft();
+        else if(prev != curr->getRight() && curr->getRight() != NULL) // Then the right one
+            next = curr->getRight();
+        else { // Both done, their heights are on top of the stack
+            int rightHeight = 0, leftHeight = 0;
+            if(curr->getRight() != NULL){
+                rightHeight = heights.back();
+                heights.pop_back();
+            }
+            if(curr->getLeft() != NULL){
+                leftHeight = heights.back();
+                heights.pop_back();
+            }
+            int skew = abs(leftHeight - rightHeight);
+            if(skew > 1)
+                shape.balanced = false;
+            shape.maxSkew = std::max(shape.maxSkew, skew);
+            ++shape.nodes;
+            heights.push_back(1 + std::max(leftHeight, rightHeight));
+            next = curr->getParent();
+        }
+        prev = curr;
+        curr = next;
+    }
+    shape.height = heights.back();
+    return shape;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+/**
+* The items in [first, last) for a subclass's buildFrom: copied out,
+* sorted by key on up to threads threads, and cut down to one item per
+* key. Where a key repeats, the last one given wins, as it would with a
+* run of insert() calls.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename InputIterator>
+std::vector<std::pair<Key, Value> > BinarySearchTree<Key, Value, Arena, Compare>::sortedItems(InputIterator first, InputIterator last, unsigned threads) const
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    sortByKey(items.begin(), items.end(), threads);
+
+    // The sort is stable, so the last of each run of equal keys is the last one given
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < items.size(); ++i){
+        if(i + 1 < items.size() && !compare_.less(items[i].first, items[i + 1].first))
+            continue;
+        if(kept != i)
+            items[kept] = std::move(items[i]);
+        ++kept;
+    }
+    items.erase(items.begin() + kept, items.end());
+    return items;
+}
+
+/**
+* Stable sort of [first, last) by key. While there are threads to spare
+* and more than BST_PARALLEL_SORT_MIN items, the left half is sorted on
+* another thread, and the halves are then merged.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename RandomIterator>
+void BinarySearchTree<Key, Value, Arena, Compare>::sortByKey(RandomIterator first, RandomIterator last, unsigned threads) const
+{
+    typedef typename std::iterator_traits<RandomIterator>::value_type Item;
+    auto byKey = [this](const Item& a, const Item& b) { return this->compare_.less(a.first, b.first); };
+    std::size_t n = last - first;
+    if(threads <= 1 || n < BST_PARALLEL_SORT_MIN){
+        std::stable_sort(first, last, byKey);
+        return;
+    }
+    RandomIterator mid = first + n / 2;
+    unsigned leftThreads = threads / 2;
+    std::future<void> leftFuture = std::async(std::launch::async, [=]() {
+        sortByKey(first, mid, leftThreads);
+    });
+    sortByKey(mid, last, threads - leftThreads);
+    leftFuture.get();
+    std::inplace_merge(first, mid, last, byKey);
+}
+
+template<typename Key, typename Value, typename Arena, typename Compare>
+void BinarySearchTree<Key, Value, Arena, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    BST_STAT(STAT_NODE_SWAPS, 1);
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
@@ -786,14 +2098,10 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
 
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* root) const
+template<typename Key, typename Value, typename Arena, typename Compare>
+int BinarySearchTree<Key, Value, Arena, Compare>::getHeight(Node<Key, Value>* root) const
 {
-    if(root == NULL)
-        return 0;
-    if(root->getLeft() == NULL)
-        return 1 + getHeight(root->getRight());
-    return 1 + getHeight(root->getLeft());
+    return shapeOf(root).height;
 }
 
 /**
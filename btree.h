@@ -0,0 +1,801 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/**
+* A B+ tree with the same map interface as BinarySearchTree and AVLTree,
+* so code can switch engines with a typedef, as long as it follows the
+* invalidation rules below.
+*
+* Every node holds up to Fanout sorted entries in arrays, so a lookup
+* takes one cache-friendly scan per level instead of one pointer chase
+* per key. Inner nodes hold only separator keys and child pointers. The
+* items live in the leaves, which are linked for iteration. Separator
+* keys are stored by value, so Key must be default constructible and
+* assignable.
+*
+* Items live in the leaf arrays, not in nodes of their own, so they move
+* when a leaf shifts, splits, borrows or merges. Unlike the binary trees,
+* where an iterator or reference stays good until its own item is
+* removed:
+*  - An insert that adds a key invalidates every iterator, pointer and
+*    reference into the tree, except the iterator it returns. One that
+*    overwrites an existing key's value invalidates nothing.
+*  - A remove that finds its key invalidates every iterator, pointer and
+*    reference into the tree. One that doesn't find its key invalidates
+*    nothing.
+*  - Lookups, iteration and writes through a Value& never do.
+*  - end() is never invalidated, except by destroying the tree.
+* An invalidated iterator may silently point at a different item, so
+* look the key up again after the update instead.
+*/
+template <typename Key, typename Value, std::size_t Fanout = 16>
+class BTree
+{
+    static_assert(Fanout >= 4, "BTree needs a fanout of at least 4");
+
+protected:
+    struct NodeBase
+    {
+        std::size_t count_; // Items in a leaf, children in an inner node
+    };
+
+    struct LeafNode : NodeBase
+    {
+        LeafNode* prev_;
+        LeafNode* next_;
+        // One spare slot so an insert can overfill the leaf before it splits
+        typename std::aligned_storage<sizeof(std::pair<const Key, Value>),
+                                      alignof(std::pair<const Key, Value>)>::type slots_[Fanout + 1];
+    };
+
+    struct InnerNode : NodeBase
+    {
+        Key keys_[Fanout];                // keys_[i] is the smallest key under children_[i + 1]
+        NodeBase* children_[Fanout + 1];  // Again one spare for the split
+    };
+
+public:
+    /**
+    * A bidirectional iterator over the items in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BTree<Key, Value, Fanout>;
+        iterator(LeafNode* leaf, std::size_t index, const BTree<Key, Value, Fanout>* tree);
+        LeafNode* leaf_;
+        std::size_t index_;
+        const BTree<Key, Value, Fanout>* tree_;
+    };
+
+    BTree();
+    virtual ~BTree();
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    bool isBalanced() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    static std::pair<const Key, Value>& itemAt(LeafNode* leaf, std::size_t i);
+    static std::size_t leafSearch(LeafNode* leaf, const Key& key);
+    static std::size_t innerSearch(const InnerNode* inner, const Key& key);
+    static void moveItem(LeafNode* from, std::size_t i, LeafNode* to, std::size_t j);
+    static void shiftRight(LeafNode* leaf, std::size_t pos);
+    static void shiftLeft(LeafNode* leaf, std::size_t pos);
+    static void eraseChild(InnerNode* inner, std::size_t i);
+
+    LeafNode* findLeaf(const Key& key) const;
+    LeafNode* lastLeaf() const;
+    NodeBase* insertHelper(NodeBase* node, int height, const std::pair<const Key, Value>& keyValuePair,
+                           Key& separator, LeafNode*& leaf, std::size_t& index, bool& inserted);
+    bool removeHelper(NodeBase* node, int height, const Key& key);
+    void fixLeafChild(InnerNode* parent, std::size_t i);
+    void fixInnerChild(InnerNode* parent, std::size_t i);
+    void clearHelper(NodeBase* node, int height);
+
+private:
+    BTree(const BTree&);
+    BTree& operator=(const BTree&);
+
+protected:
+    NodeBase* root_;
+    int height_;         // Levels of inner nodes above the leaves
+    std::size_t size_;
+};
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the BTree::iterator class.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value, std::size_t Fanout>
+BTree<Key, Value, Fanout>::iterator::iterator(LeafNode* leaf, std::size_t index, const BTree<Key, Value, Fanout>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+BTree<Key, Value, Fanout>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0),
+    tree_(NULL)
+{
+
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+std::pair<const Key,Value> &
+BTree<Key, Value, Fanout>::iterator::operator*() const
+{
+    return itemAt(leaf_, index_);
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+std::pair<const Key,Value> *
+BTree<Key, Value, Fanout>::iterator::operator->() const
+{
+    return &itemAt(leaf_, index_);
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+bool
+BTree<Key, Value, Fanout>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+bool
+BTree<Key, Value, Fanout>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Steps to the next slot, or to the start of the next leaf.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator&
+BTree<Key, Value, Fanout>::iterator::operator++()
+{
+    if(++index_ == leaf_->count_){
+        leaf_ = leaf_->next_;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator
+BTree<Key, Value, Fanout>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back one item. Stepping back from end() lands on the largest item.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator&
+BTree<Key, Value, Fanout>::iterator::operator--()
+{
+    if(leaf_ == NULL){
+        leaf_ = tree_->lastLeaf();
+        index_ = leaf_->count_ - 1;
+    } else if(index_ == 0){
+        leaf_ = leaf_->prev_;
+        index_ = leaf_->count_ - 1;
+    } else {
+        --index_;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator
+BTree<Key, Value, Fanout>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the BTree::iterator class.
+  -----------------------------------------------------
+*/
+
+/*
+  ---------------------------------------
+  Begin implementations for the BTree class.
+  ---------------------------------------
+*/
+
+template<typename Key, typename Value, std::size_t Fanout>
+BTree<Key, Value, Fanout>::BTree() :
+    root_(NULL),
+    height_(0),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+BTree<Key, Value, Fanout>::~BTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* Returns an iterator to the item and whether it was newly added.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+std::pair<typename BTree<Key, Value, Fanout>::iterator, bool>
+BTree<Key, Value, Fanout>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(root_ == NULL){
+        LeafNode* leaf = new LeafNode;
+        leaf->count_ = 0;
+        leaf->prev_ = NULL;
+        leaf->next_ = NULL;
+        root_ = leaf;
+        height_ = 0;
+    }
+    // A full root may split, so have the new root ready before anything changes
+    InnerNode* newRoot = root_->count_ == Fanout ? new InnerNode : NULL;
+
+    Key separator;
+    LeafNode* leaf = NULL;
+    std::size_t index = 0;
+    bool inserted = false;
+    NodeBase* right;
+    try {
+        right = insertHelper(root_, height_, keyValuePair, separator, leaf, index, inserted);
+    } catch(...) {
+        delete newRoot;
+        if(size_ == 0){ // Drop the empty leaf made above
+            delete static_cast<LeafNode*>(root_);
+            root_ = NULL;
+        }
+        throw;
+    }
+    if(right != NULL){ // The root split, grow a level
+        newRoot->count_ = 2;
+        newRoot->keys_[0] = separator;
+        newRoot->children_[0] = root_;
+        newRoot->children_[1] = right;
+        root_ = newRoot;
+        ++height_;
+    } else {
+        delete newRoot;
+    }
+    if(inserted)
+        ++size_;
+    return std::make_pair(iterator(leaf, index, this), inserted);
+}
+
+/**
+* Inserts into the subtree at node, which is height levels above the leaves.
+* If node had to split, returns the new right half and sets separator to
+* the smallest key under it; otherwise returns NULL. leaf and index are
+* set to where the item ended up.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::NodeBase*
+BTree<Key, Value, Fanout>::insertHelper(NodeBase* node, int height, const std::pair<const Key, Value>& keyValuePair,
+                                        Key& separator, LeafNode*& leaf, std::size_t& index, bool& inserted)
+{
+    if(height == 0){
+        LeafNode* l = static_cast<LeafNode*>(node);
+        std::size_t pos = leafSearch(l, keyValuePair.first);
+        if(pos < l->count_ && !(keyValuePair.first < itemAt(l, pos).first)){ // Key exists, overwrite
+            itemAt(l, pos).second = keyValuePair.second;
+            leaf = l;
+            index = pos;
+            return NULL;
+        }
+        // Allocate before touching anything, so a failure leaves the leaf as it was
+        LeafNode* r = l->count_ == Fanout ? new LeafNode : NULL;
+        shiftRight(l, pos);
+        try {
+            new (&l->slots_[pos]) std::pair<const Key, Value>(keyValuePair);
+        } catch(...) {
+            ++l->count_;
+            shiftLeft(l, pos);
+            --l->count_;
+            delete r;
+            throw;
+        }
+        ++l->count_;
+        inserted = true;
+        leaf = l;
+        index = pos;
+        if(r == NULL)
+            return NULL;
+
+        // Overfull, move the upper half to a new leaf
+        std::size_t keep = l->count_ / 2;
+        for(std::size_t i = keep; i < l->count_; ++i)
+            moveItem(l, i, r, i - keep);
+        r->count_ = l->count_ - keep;
+        l->count_ = keep;
+        r->next_ = l->next_;
+        if(r->next_ != NULL)
+            r->next_->prev_ = r;
+        r->prev_ = l;
+        l->next_ = r;
+        if(index >= keep){
+            leaf = r;
+            index -= keep;
+        }
+        separator = itemAt(r, 0).first;
+        return r;
+    }
+
+    InnerNode* in = static_cast<InnerNode*>(node);
+    std::size_t i = innerSearch(in, keyValuePair.first);
+    NodeBase* child = in->children_[i];
+    // Only a full child can split; have the new sibling ready if this node is full too
+    InnerNode* r = (in->count_ == Fanout && child->count_ == Fanout) ? new InnerNode : NULL;
+    Key childSeparator;
+    NodeBase* newChild;
+    try {
+        newChild = insertHelper(child, height - 1, keyValuePair, childSeparator, leaf, index, inserted);
+    } catch(...) {
+        delete r;
+        throw;
+    }
+    if(newChild == NULL){
+        delete r;
+        return NULL;
+    }
+    for(std::size_t j = in->count_; j > i + 1; --j)
+        in->children_[j] = in->children_[j - 1];
+    for(std::size_t j = in->count_ - 1; j > i; --j)
+        in->keys_[j] = in->keys_[j - 1];
+    in->keys_[i] = childSeparator;
+    in->children_[i + 1] = newChild;
+    ++in->count_;
+    if(r == NULL)
+        return NULL;
+
+    // Overfull, the middle key moves up and the upper half moves right
+    std::size_t keep = in->count_ / 2;
+    separator = in->keys_[keep - 1];
+    for(std::size_t j = keep; j < in->count_; ++j)
+        r->children_[j - keep] = in->children_[j];
+    for(std::size_t j = keep; j + 1 < in->count_; ++j)
+        r->keys_[j - keep] = in->keys_[j];
+    r->count_ = in->count_ - keep;
+    in->count_ = keep;
+    return r;
+}
+
+/**
+* Removes the item with the given key, if there is one.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::remove(const Key& key)
+{
+    if(root_ == NULL)
+        return;
+    if(!removeHelper(root_, height_, key))
+        return;
+    --size_;
+    if(height_ > 0 && root_->count_ == 1){ // Root has one child left, shrink a level
+        InnerNode* old = static_cast<InnerNode*>(root_);
+        root_ = old->children_[0];
+        delete old;
+        --height_;
+    } else if(height_ == 0 && root_->count_ == 0){
+        delete static_cast<LeafNode*>(root_);
+        root_ = NULL;
+    }
+}
+
+/**
+* Removes key from the subtree at node. Returns whether it was found.
+* Children left under half full are topped up from a sibling or merged
+* into one, so node itself may end up under half full for its parent to fix.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+bool BTree<Key, Value, Fanout>::removeHelper(NodeBase* node, int height, const Key& key)
+{
+    if(height == 0){
+        LeafNode* l = static_cast<LeafNode*>(node);
+        std::size_t pos = leafSearch(l, key);
+        if(pos == l->count_ || key < itemAt(l, pos).first)
+            return false;
+        itemAt(l, pos).~pair();
+        shiftLeft(l, pos);
+        --l->count_;
+        return true;
+    }
+
+    InnerNode* in = static_cast<InnerNode*>(node);
+    std::size_t i = innerSearch(in, key);
+    if(!removeHelper(in->children_[i], height - 1, key))
+        return false;
+    if(in->children_[i]->count_ < Fanout / 2){
+        if(height == 1)
+            fixLeafChild(in, i);
+        else
+            fixInnerChild(in, i);
+    }
+    return true;
+}
+
+/**
+* Tops up the under-full leaf at parent->children_[i] with an item from a
+* sibling that can spare one, or else merges it with a sibling.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::fixLeafChild(InnerNode* parent, std::size_t i)
+{
+    LeafNode* c = static_cast<LeafNode*>(parent->children_[i]);
+    LeafNode* left = i > 0 ? static_cast<LeafNode*>(parent->children_[i - 1]) : NULL;
+    LeafNode* right = i + 1 < parent->count_ ? static_cast<LeafNode*>(parent->children_[i + 1]) : NULL;
+
+    if(left != NULL && left->count_ > Fanout / 2){ // Borrow the largest item on the left
+        shiftRight(c, 0);
+        moveItem(left, left->count_ - 1, c, 0);
+        --left->count_;
+        ++c->count_;
+        parent->keys_[i - 1] = itemAt(c, 0).first;
+        return;
+    }
+    if(right != NULL && right->count_ > Fanout / 2){ // Borrow the smallest item on the right
+        moveItem(right, 0, c, c->count_);
+        ++c->count_;
+        shiftLeft(right, 0);
+        --right->count_;
+        parent->keys_[i] = itemAt(right, 0).first;
+        return;
+    }
+
+    // Neither sibling can spare one, so the pair fits in one leaf
+    if(left == NULL){
+        left = c;
+        c = right;
+        ++i;
+    }
+    for(std::size_t j = 0; j < c->count_; ++j)
+        moveItem(c, j, left, left->count_ + j);
+    left->count_ += c->count_;
+    left->next_ = c->next_;
+    if(c->next_ != NULL)
+        c->next_->prev_ = left;
+    delete c;
+    eraseChild(parent, i);
+}
+
+/**
+* The inner node version of fixLeafChild. Borrowed children bring the
+* parent's separator down with them and send the sibling's up in its place.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::fixInnerChild(InnerNode* parent, std::size_t i)
+{
+    InnerNode* c = static_cast<InnerNode*>(parent->children_[i]);
+    InnerNode* left = i > 0 ? static_cast<InnerNode*>(parent->children_[i - 1]) : NULL;
+    InnerNode* right = i + 1 < parent->count_ ? static_cast<InnerNode*>(parent->children_[i + 1]) : NULL;
+
+    if(left != NULL && left->count_ > Fanout / 2){ // Borrow the last child on the left
+        for(std::size_t j = c->count_; j > 0; --j)
+            c->children_[j] = c->children_[j - 1];
+        for(std::size_t j = c->count_ - 1; j > 0; --j)
+            c->keys_[j] = c->keys_[j - 1];
+        c->keys_[0] = parent->keys_[i - 1];
+        c->children_[0] = left->children_[left->count_ - 1];
+        ++c->count_;
+        parent->keys_[i - 1] = left->keys_[left->count_ - 2];
+        --left->count_;
+        return;
+    }
+    if(right != NULL && right->count_ > Fanout / 2){ // Borrow the first child on the right
+        c->keys_[c->count_ - 1] = parent->keys_[i];
+        c->children_[c->count_] = right->children_[0];
+        ++c->count_;
+        parent->keys_[i] = right->keys_[0];
+        for(std::size_t j = 0; j + 2 < right->count_; ++j)
+            right->keys_[j] = right->keys_[j + 1];
+        for(std::size_t j = 0; j + 1 < right->count_; ++j)
+            right->children_[j] = right->children_[j + 1];
+        --right->count_;
+        return;
+    }
+
+    // Merge, with the parent's separator between the two halves
+    if(left == NULL){
+        left = c;
+        c = right;
+        ++i;
+    }
+    left->keys_[left->count_ - 1] = parent->keys_[i - 1];
+    for(std::size_t j = 0; j + 1 < c->count_; ++j)
+        left->keys_[left->count_ + j] = c->keys_[j];
+    for(std::size_t j = 0; j < c->count_; ++j)
+        left->children_[left->count_ + j] = c->children_[j];
+    left->count_ += c->count_;
+    delete c;
+    eraseChild(parent, i);
+}
+
+/**
+* Drops children_[i] and the separator to its left, keys_[i - 1].
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::eraseChild(InnerNode* inner, std::size_t i)
+{
+    for(std::size_t j = i - 1; j + 2 < inner->count_; ++j)
+        inner->keys_[j] = inner->keys_[j + 1];
+    for(std::size_t j = i; j + 1 < inner->count_; ++j)
+        inner->children_[j] = inner->children_[j + 1];
+    --inner->count_;
+}
+
+/**
+* Deletes all the nodes and items.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::clear()
+{
+    if(root_ != NULL)
+        clearHelper(root_, height_);
+    root_ = NULL;
+    height_ = 0;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::clearHelper(NodeBase* node, int height)
+{
+    if(height == 0){
+        LeafNode* l = static_cast<LeafNode*>(node);
+        for(std::size_t i = 0; i < l->count_; ++i)
+            itemAt(l, i).~pair();
+        delete l;
+        return;
+    }
+    InnerNode* in = static_cast<InnerNode*>(node);
+    for(std::size_t i = 0; i < in->count_; ++i)
+        clearHelper(in->children_[i], height - 1);
+    delete in;
+}
+
+/**
+* Return true iff the BTree is empty.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+bool BTree<Key, Value, Fanout>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+std::size_t BTree<Key, Value, Fanout>::size() const
+{
+    return size_;
+}
+
+/**
+* Always true: every leaf of a B+ tree is at the same depth.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+bool BTree<Key, Value, Fanout>::isBalanced() const
+{
+    return true;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator
+BTree<Key, Value, Fanout>::begin() const
+{
+    if(root_ == NULL)
+        return end();
+    NodeBase* node = root_;
+    for(int h = height_; h > 0; --h)
+        node = static_cast<InnerNode*>(node)->children_[0];
+    return iterator(static_cast<LeafNode*>(node), 0, this);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator
+BTree<Key, Value, Fanout>::end() const
+{
+    return iterator(NULL, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::iterator
+BTree<Key, Value, Fanout>::find(const Key& key) const
+{
+    LeafNode* leaf = findLeaf(key);
+    if(leaf == NULL)
+        return end();
+    std::size_t pos = leafSearch(leaf, key);
+    if(pos == leaf->count_ || key < itemAt(leaf, pos).first)
+        return end();
+    return iterator(leaf, pos, this);
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+Value& BTree<Key, Value, Fanout>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+Value const & BTree<Key, Value, Fanout>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Returns the leaf that key belongs in, or NULL if the tree is empty.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::LeafNode*
+BTree<Key, Value, Fanout>::findLeaf(const Key& key) const
+{
+    NodeBase* node = root_;
+    if(node == NULL)
+        return NULL;
+    for(int h = height_; h > 0; --h){
+        InnerNode* in = static_cast<InnerNode*>(node);
+        node = in->children_[innerSearch(in, key)];
+    }
+    return static_cast<LeafNode*>(node);
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+typename BTree<Key, Value, Fanout>::LeafNode*
+BTree<Key, Value, Fanout>::lastLeaf() const
+{
+    NodeBase* node = root_;
+    for(int h = height_; h > 0; --h)
+        node = static_cast<InnerNode*>(node)->children_[node->count_ - 1];
+    return static_cast<LeafNode*>(node);
+}
+
+template<typename Key, typename Value, std::size_t Fanout>
+std::pair<const Key, Value>& BTree<Key, Value, Fanout>::itemAt(LeafNode* leaf, std::size_t i)
+{
+    return *reinterpret_cast<std::pair<const Key, Value>*>(&leaf->slots_[i]);
+}
+
+/**
+* Returns the first slot in leaf whose key is not less than key.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+std::size_t BTree<Key, Value, Fanout>::leafSearch(LeafNode* leaf, const Key& key)
+{
+    std::size_t lo = 0, hi = leaf->count_;
+    while(lo < hi){
+        std::size_t mid = (lo + hi) / 2;
+        if(itemAt(leaf, mid).first < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+* Returns the child of inner whose subtree key belongs in.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+std::size_t BTree<Key, Value, Fanout>::innerSearch(const InnerNode* inner, const Key& key)
+{
+    std::size_t lo = 0, hi = inner->count_ - 1;
+    while(lo < hi){
+        std::size_t mid = (lo + hi) / 2;
+        if(key < inner->keys_[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/**
+* Move constructs slot j of to from slot i of from, leaving slot i empty.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::moveItem(LeafNode* from, std::size_t i, LeafNode* to, std::size_t j)
+{
+    std::pair<const Key, Value>& item = itemAt(from, i);
+    new (&to->slots_[j]) std::pair<const Key, Value>(std::move(item));
+    item.~pair();
+}
+
+/**
+* Moves slots [pos, count_) up by one, leaving slot pos empty.
+* Slot count_ must be empty; count_ is left for the caller.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::shiftRight(LeafNode* leaf, std::size_t pos)
+{
+    for(std::size_t j = leaf->count_; j > pos; --j)
+        moveItem(leaf, j - 1, leaf, j);
+}
+
+/**
+* Moves slots (pos, count_) down by one to fill the empty slot pos.
+* count_ is left for the caller.
+*/
+template<typename Key, typename Value, std::size_t Fanout>
+void BTree<Key, Value, Fanout>::shiftLeft(LeafNode* leaf, std::size_t pos)
+{
+    for(std::size_t j = pos; j + 1 < leaf->count_; ++j)
+        moveItem(leaf, j + 1, leaf, j);
+}
+
+/*
+  -------------------------------------
+  End implementations for the BTree class.
+  -------------------------------------
+*/
+
+#endif
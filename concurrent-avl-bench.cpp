@@ -0,0 +1,97 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include "avlbst.h"
+#include "concurrentavl.h"
+
+using namespace std;
+
+// Throughput of a read-mostly mix (90% find, 5% insert, 5% remove) over
+// random keys, from one thread up to every core. Compared against the
+// single-threaded AVLTree behind one global mutex.
+static const int KEYS = 1000000;
+static const double SECONDS = 0.5;
+
+struct LockedAVL
+{
+    AVLTree<int,int> tree;
+    mutex lock;
+
+    void insert(int k) { lock_guard<mutex> g(lock); tree.insert(make_pair(k, k)); }
+    void remove(int k) { lock_guard<mutex> g(lock); tree.remove(k); }
+    bool find(int k) { lock_guard<mutex> g(lock); return tree.find(k) != tree.end(); }
+};
+
+struct Concurrent
+{
+    ConcurrentAVLTree<int,int> tree;
+
+    void insert(int k) { tree.insert(make_pair(k, k)); }
+    void remove(int k) { tree.remove(k); }
+    bool find(int k) { int v; return tree.find(k, v); }
+};
+
+template<typename Map>
+double run(Map& map, unsigned threads)
+{
+    atomic<bool> stop(false);
+    atomic<long> total(0), found(0);
+    vector<thread> workers;
+    for(unsigned t = 0; t < threads; t++) {
+        workers.push_back(thread([&, t]() {
+            mt19937 gen(t + 1);
+            long ops = 0, hits = 0;
+            while(!stop.load(memory_order_relaxed)) {
+                for(int i = 0; i < 256; i++, ops++) {
+                    int k = gen() % KEYS;
+                    int op = gen() % 20;
+                    if(op == 0) map.insert(k);
+                    else if(op == 1) map.remove(k);
+                    else hits += map.find(k);
+                }
+            }
+            total += ops;
+            found += hits; // Keeps the lookups from being optimized away
+        }));
+    }
+    this_thread::sleep_for(chrono::duration<double>(SECONDS));
+    stop = true;
+    for(unsigned t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    return total / SECONDS / 1e6;
+}
+
+template<typename Map>
+void fill(Map& map)
+{
+    mt19937 gen(0);
+    for(int i = 0; i < KEYS / 2; i++) {
+        map.insert(gen() % KEYS);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned cores = thread::hardware_concurrency();
+    if(cores == 0) cores = 1;
+    if(argc > 1) cores = atoi(argv[1]);
+
+    LockedAVL locked;
+    Concurrent concurrent;
+    fill(locked);
+    fill(concurrent);
+
+    cout << "threads  mutex+AVLTree  ConcurrentAVLTree  (Mops/s)" << endl;
+    for(unsigned threads = 1; threads <= cores; threads *= 2) {
+        cout << setw(7) << threads << setw(15) << fixed << setprecision(2) << run(locked, threads)
+             << setw(19) << run(concurrent, threads) << endl;
+        if(threads < cores && threads * 2 > cores) threads = cores / 2; // Always end on every core
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include "concurrentavl.h"
+
+using namespace std;
+
+// Every key k maps to 2k, so any value a reader sees can be checked.
+// Keys divisible by 10 are inserted up front and never removed. Every other
+// key belongs to one thread, which inserts and removes it at random and
+// remembers whether it should be there at the end.
+static const int KEYS = 20000;
+static const int OPS_PER_THREAD = 200000;
+
+// Stops a search part way down while a writer runs, to replay interleavings
+// the threads below only hit by luck.
+class StalledSearchTree : public ConcurrentAVLTree<int,int>
+{
+public:
+    // Takes a search for key as far as the node holding at, which must be
+    // on key's path, and runs writer. Then resumes the search from there
+    // with the version it saw, retrying from the root if told to, and
+    // returns whether it found key.
+    template<typename Writer>
+    bool stallAt(int at, int key, Writer writer)
+    {
+        Node* node = locate(at);
+        if(node == NULL) return false;
+        uint64_t version = node->version_.load();
+        writer(*this);
+        Node* found;
+        if(findFrom(key, node, key < at ? -1 : 1, version, found) == RETRY) {
+            found = locate(key);
+        }
+        return found != NULL && found->present_.load();
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = thread::hardware_concurrency();
+    if(threads < 4) threads = 4;
+
+    // The root, 8, has two children, and 7 must stay findable while it goes
+    int missed = 0;
+    StalledSearchTree wide;
+    for(int k = 1; k <= 15; k++) {
+        wide.insert(make_pair(k, 2 * k));
+    }
+    if(!wide.stallAt(4, 7, [](StalledSearchTree& t) { t.remove(8); })) missed++;
+    // Emptying the right side rotates the root, 4, down and 1 out from under it
+    StalledSearchTree narrow;
+    for(int k = 1; k <= 7; k++) {
+        narrow.insert(make_pair(k, 2 * k));
+    }
+    if(!narrow.stallAt(4, 1, [](StalledSearchTree& t) { t.remove(7); t.remove(6); t.remove(5); })) missed++;
+    cout << "Stalled searches missed: " << missed << endl;
+
+    ConcurrentAVLTree<int,int> tree;
+    for(int k = 0; k < KEYS; k += 10) {
+        tree.insert(make_pair(k, 2 * k));
+    }
+
+    atomic<long> errors(missed);
+    vector<vector<bool> > expected(threads, vector<bool>(KEYS, false));
+    vector<thread> workers;
+    for(unsigned t = 0; t < threads; t++) {
+        workers.push_back(thread([&, t]() {
+            mt19937 gen(t + 1);
+            vector<bool>& mine = expected[t];
+            for(int i = 0; i < OPS_PER_THREAD; i++) {
+                int k = gen() % KEYS;
+                int op = gen() % 10;
+                int value;
+                if(k % 10 == 0) { // Stable keys must always be found
+                    if(op == 0) {
+                        tree.insert(make_pair(k, 2 * k));
+                    } else if(!tree.find(k, value) || value != 2 * k) {
+                        errors++;
+                    }
+                } else if(k % (int)threads == (int)t && op < 3) {
+                    tree.insert(make_pair(k, 2 * k));
+                    mine[k] = true;
+                } else if(k % (int)threads == (int)t && op < 6) {
+                    tree.remove(k);
+                    mine[k] = false;
+                } else if(tree.find(k, value) && value != 2 * k) {
+                    errors++;
+                }
+            }
+        }));
+    }
+    for(unsigned t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+
+    size_t count = 0;
+    for(int k = 0; k < KEYS; k++) {
+        bool want = k % 10 == 0 || (k % 10 != 0 && expected[k % threads][k]);
+        if(want) count++;
+        if(tree.contains(k) != want) errors++;
+    }
+    cout << threads << " threads, " << tree.size() << " keys left (expected " << count << ")" << endl;
+    cout << "Balanced: " << tree.isBalanced() << ", errors: " << errors << endl;
+    bool passed = errors == 0 && tree.size() == count && tree.isBalanced();
+    cout << (passed ? "PASSED" : "FAILED") << endl;
+    return passed ? 0 : 1;
+}
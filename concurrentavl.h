@@ -0,0 +1,932 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Removed nodes are freed in batches of this many, once no reader can still see them.
+static const std::size_t CONCURRENT_AVL_RETIRE_BATCH = 64;
+// Reader counters are spread over this many cache lines to keep readers off each other's.
+static const std::size_t CONCURRENT_AVL_READER_STRIPES = 16;
+
+/**
+* An AVL tree that any number of threads may use at once. The design is
+* the one from Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent
+* Binary Search Tree" (PPoPP 2010).
+*
+* Searches take no locks on the way down. Each node carries a version
+* number, and it changes only when keys leave the node's subtree: when a
+* rotation moves the node down, or when the node is unlinked. A search
+* remembers a node's version, reads the next link, then checks the version
+* again before stepping down. On a mismatch it goes back one level, to the
+* node it came from, and reads that link again. A new leaf or a rotation
+* that lifts a node only adds keys under it, so neither touches versions.
+*
+* Keys never move between nodes. Removing a key whose node has two
+* children only clears the node's value, leaving a routing node that
+* searches still pass through. Nodes with at most one child are unlinked
+* on the spot, and routing nodes follow once they lose a child.
+*
+* Writers lock only the nodes they change, always parent before child:
+* the node whose value they set, the parent that gets a new leaf, parent
+* and node for an unlink, and the three to four nodes of a rotation.
+* Balance is relaxed. Each writer fixes heights and rotates on its way back
+* up, one small neighbourhood at a time, so while writers overlap the tree
+* may be briefly out of balance. Once they are all done it is a strict AVL
+* tree again, counting routing nodes.
+*
+* Unlinked nodes are not freed while another thread might still hold them.
+* Every operation registers in one of two reader counts, picked by a
+* global epoch. Freeing flips the epoch, waits for the old count to reach
+* zero, and only then deletes the nodes unlinked before the flip.
+*
+* There is no iteration, since no iterator could stay valid under
+* concurrent removes. find() hands back a copy of the value, taken under
+* the node's lock.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    struct Node;
+
+    /**
+    * Everything but the item, so the holder above the root needs no key.
+    * Can be locked with std::lock_guard.
+    */
+    struct NodeBase
+    {
+        NodeBase();
+        void lock();
+        void unlock();
+        Node* child(int dir) const;
+        void setChild(int dir, Node* child);
+
+        std::atomic<Node*> left_;
+        std::atomic<Node*> right_;
+        std::atomic<NodeBase*> parent_;       // Changed under the old and new parents' locks
+        std::atomic<std::uint64_t> version_;
+        std::atomic<int> height_;             // Set under this node's lock
+        std::atomic<bool> present_;           // False for routing nodes, set under this node's lock
+        std::atomic<bool> locked_;
+    };
+
+    struct Node : public NodeBase
+    {
+        Node(const std::pair<const Key, Value>& keyValuePair, NodeBase* parent);
+
+        const Key key_;
+        Value value_;                         // Guarded by locked_
+    };
+
+    struct ReaderStripe
+    {
+        alignas(64) std::atomic<long> count_[2];
+    };
+
+    /**
+    * Marks the calling thread as reading for as long as it lives.
+    */
+    class ReadGuard
+    {
+    public:
+        ReadGuard(const ConcurrentAVLTree<Key, Value>* tree);
+        ~ReadGuard();
+
+    private:
+        std::atomic<long>* count_;
+    };
+
+    // What a search came to. PRESENT and ABSENT say whether the key was in the tree.
+    enum Outcome { RETRY, ABSENT, PRESENT };
+
+    // Version bits. Set while a rotation moves the node down, and for good once it is unlinked.
+    static const std::uint64_t SHRINKING = 1;
+    static const std::uint64_t UNLINKED = 2;
+    static const std::uint64_t VERSION_STEP = 4;
+
+    // What nodeCondition found, when it is not simply a new height.
+    static const int NOTHING_REQUIRED = -1;
+    static const int UNLINK_REQUIRED = -2;
+    static const int REBALANCE_REQUIRED = -3;
+
+    static int order(const Key& key, const Key& nodeKey);
+    static void waitUntilShrunk(const NodeBase* node, std::uint64_t version);
+    template<typename OnMatch, typename OnMissing>
+    Outcome descend(const Key& key, NodeBase* node, int dir, std::uint64_t version,
+                    OnMatch& onMatch, OnMissing& onMissing) const;
+    Outcome findFrom(const Key& key, NodeBase* node, int dir, std::uint64_t version, Node*& found) const;
+    Node* locate(const Key& key) const;
+
+    Outcome attachLeaf(const std::pair<const Key, Value>& keyValuePair, NodeBase* parent,
+                       int dir, std::uint64_t version);
+    Outcome setValue(Node* node, const Value& value);
+    Outcome removeNode(NodeBase* parent, Node* node);
+    bool attemptUnlink(NodeBase* parent, Node* node);
+
+    static int heightOf(const Node* node);
+    static int nodeCondition(const NodeBase* node);
+    void fixHeightAndRebalance(NodeBase* node);
+    NodeBase* fixHeight(NodeBase* node);
+    NodeBase* rebalance(NodeBase* parent, Node* n, std::vector<NodeBase*>& later);
+    NodeBase* rebalanceTo(NodeBase* parent, Node* n, int heavy, Node* c, int hOther,
+                          std::vector<NodeBase*>& later);
+    NodeBase* rotate(NodeBase* parent, Node* n, int heavy, Node* c, int hOther, int hOuter,
+                     Node* inner, int hInner, std::vector<NodeBase*>& later);
+    NodeBase* rotateDouble(NodeBase* parent, Node* n, int heavy, Node* c, int hOther, int hOuter,
+                           Node* inner, int hInnerOuter, std::vector<NodeBase*>& later);
+
+    void retire(Node* node);
+    void reclaimIfDue();
+    void reclaim();
+    void clearHelper(Node* node);
+    int balancedRec(const Node* node, bool& balanced) const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+protected:
+    mutable NodeBase holder_;             // Never changes version; its right child is the root
+    std::atomic<std::size_t> size_;
+    std::mutex retireLock_;               // Guards retired_
+    std::mutex reclaimLock_;              // One thread frees at a time
+    std::vector<Node*> retired_;          // Unlinked, but maybe still seen by another thread
+    std::atomic<std::size_t> retiredCount_;
+    mutable std::atomic<unsigned> epoch_;
+    mutable ReaderStripe readers_[CONCURRENT_AVL_READER_STRIPES];
+};
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::NodeBase class.
+  ---------------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::NodeBase::NodeBase() :
+    left_(NULL),
+    right_(NULL),
+    parent_(NULL),
+    version_(0),
+    height_(0),
+    present_(false),
+    locked_(false)
+{
+
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::NodeBase::lock()
+{
+    while(locked_.exchange(true, std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::NodeBase::unlock()
+{
+    locked_.store(false, std::memory_order_release);
+}
+
+/**
+* The left child for a negative dir, the right one otherwise.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::NodeBase::child(int dir) const
+{
+    return dir < 0 ? left_.load() : right_.load();
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::NodeBase::setChild(int dir, Node* child)
+{
+    if(dir < 0)
+        left_.store(child);
+    else
+        right_.store(child);
+}
+
+/*
+  -------------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::NodeBase class.
+  -------------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::Node class.
+  -----------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::Node::Node(const std::pair<const Key, Value>& keyValuePair, NodeBase* parent) :
+    key_(keyValuePair.first),
+    value_(keyValuePair.second)
+{
+    this->parent_.store(parent);
+    this->height_.store(1);
+    this->present_.store(true);
+}
+
+/*
+  ---------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::Node class.
+  ---------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::ReadGuard class.
+  ---------------------------------------------------------------
+*/
+
+/**
+* Registers in the count for the current epoch. If the epoch flips in
+* between, the registration might have been missed by the writer that
+* flipped it, so back out and try again.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::ReadGuard(const ConcurrentAVLTree<Key, Value>* tree)
+{
+    std::size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % CONCURRENT_AVL_READER_STRIPES;
+    for(;;){
+        unsigned epoch = tree->epoch_.load();
+        count_ = &tree->readers_[stripe].count_[epoch & 1];
+        count_->fetch_add(1);
+        if(tree->epoch_.load() == epoch)
+            return;
+        count_->fetch_sub(1);
+    }
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::~ReadGuard()
+{
+    count_->fetch_sub(1);
+}
+
+/*
+  -------------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::ReadGuard class.
+  -------------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    size_(0),
+    retiredCount_(0),
+    epoch_(0)
+{
+    for(std::size_t i = 0; i < CONCURRENT_AVL_READER_STRIPES; ++i){
+        readers_[i].count_[0] = 0;
+        readers_[i].count_[1] = 0;
+    }
+}
+
+/**
+* Must not run while another thread still uses the tree.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    clearHelper(holder_.right_.load());
+    for(std::size_t i = 0; i < retired_.size(); ++i)
+        delete retired_[i];
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* Returns whether the key was newly added.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Outcome outcome;
+    {
+        ReadGuard guard(this);
+        auto onMatch = [&](NodeBase*, Node* node) { return setValue(node, keyValuePair.second); };
+        auto onMissing = [&](NodeBase* parent, int dir, std::uint64_t version) {
+            return attachLeaf(keyValuePair, parent, dir, version);
+        };
+        outcome = descend(keyValuePair.first, &holder_, 1, holder_.version_.load(), onMatch, onMissing);
+    }
+    reclaimIfDue();
+    return outcome == ABSENT;
+}
+
+/**
+* Removes the item with the given key. Returns whether there was one.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    Outcome outcome;
+    {
+        ReadGuard guard(this);
+        auto onMatch = [&](NodeBase* parent, Node* node) { return removeNode(parent, node); };
+        auto onMissing = [](NodeBase*, int, std::uint64_t) { return ABSENT; };
+        outcome = descend(key, &holder_, 1, holder_.version_.load(), onMatch, onMissing);
+    }
+    reclaimIfDue();
+    return outcome == PRESENT;
+}
+
+/**
+* Copies the value for key into value. Returns whether key was present.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    ReadGuard guard(this);
+    Node* node = locate(key);
+    if(node == NULL)
+        return false;
+    std::lock_guard<NodeBase> lock(*node);
+    if(!node->present_.load())
+        return false;
+    value = node->value_;
+    return true;
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    ReadGuard guard(this);
+    Node* node = locate(key);
+    return node != NULL && node->present_.load();
+}
+
+template<typename Key, typename Value>
+std::size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return size_.load() == 0;
+}
+
+/**
+* Checks the AVL property everywhere. Only meaningful with no writers running.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::isBalanced() const
+{
+    bool balanced = true;
+    balancedRec(holder_.right_.load(), balanced);
+    return balanced;
+}
+
+/**
+* Three-way comparison with operator< alone: negative when key belongs
+* left of nodeKey, positive when right, 0 when they are equal.
+*/
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::order(const Key& key, const Key& nodeKey)
+{
+    if(key < nodeKey)
+        return -1;
+    return nodeKey < key ? 1 : 0;
+}
+
+/**
+* If version says a rotation was moving node down, waits for it to finish.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilShrunk(const NodeBase* node, std::uint64_t version)
+{
+    if(!(version & SHRINKING))
+        return;
+    while(node->version_.load() == version)
+        std::this_thread::yield();
+}
+
+/**
+* The optimistic descent, resumed at node, which had the given version
+* when the search arrived there, heading to its dir side. Every step reads
+* a link, then checks node's version is unchanged before going down it, so
+* no key can have left node's subtree meanwhile. Returns RETRY when node
+* has changed, and the caller one level up reads its own link again.
+*
+* onMatch(parent, node) runs on the node holding key, and onMissing(parent,
+* dir, version) on the empty link where key would go. Either may return
+* RETRY, if what it saw changed before it could lock it, and the search
+* reads the link again. The caller must hold a ReadGuard.
+*/
+template<typename Key, typename Value>
+template<typename OnMatch, typename OnMissing>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::descend(const Key& key, NodeBase* node, int dir, std::uint64_t version,
+                                       OnMatch& onMatch, OnMissing& onMissing) const
+{
+    for(;;){
+        Node* child = node->child(dir);
+        if(node->version_.load() != version)
+            return RETRY;
+        Outcome outcome;
+        if(child == NULL){
+            outcome = onMissing(node, dir, version);
+        } else {
+            int childDir = order(key, child->key_);
+            if(childDir == 0){ // Keys never move, so this is the only node key can be in
+                outcome = onMatch(node, child);
+            } else {
+                std::uint64_t childVersion = child->version_.load();
+                if(childVersion & (SHRINKING | UNLINKED)){
+                    waitUntilShrunk(child, childVersion);
+                    continue;
+                }
+                if(child != node->child(dir))
+                    continue;
+                if(node->version_.load() != version)
+                    return RETRY;
+                outcome = descend(key, child, childDir, childVersion, onMatch, onMissing);
+            }
+        }
+        if(outcome != RETRY)
+            return outcome;
+    }
+}
+
+/**
+* A lookup resumed part way down, see descend. Sets found to key's node,
+* which may be a routing node.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::findFrom(const Key& key, NodeBase* node, int dir,
+                                        std::uint64_t version, Node*& found) const
+{
+    found = NULL;
+    auto onMatch = [&](NodeBase*, Node* match) { found = match; return PRESENT; };
+    auto onMissing = [](NodeBase*, int, std::uint64_t) { return ABSENT; };
+    return descend(key, node, dir, version, onMatch, onMissing);
+}
+
+/**
+* Returns key's node, which the caller must check is present, or NULL.
+* The holder's version never changes, so a search from it never has to
+* start over. The caller must hold a ReadGuard.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::locate(const Key& key) const
+{
+    Node* found;
+    findFrom(key, &holder_, 1, holder_.version_.load(), found);
+    return found;
+}
+
+/**
+* Hangs a new node off parent's empty dir link, unless parent changed or
+* another writer filled the link first.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attachLeaf(const std::pair<const Key, Value>& keyValuePair, NodeBase* parent,
+                                          int dir, std::uint64_t version)
+{
+    Node* node = new Node(keyValuePair, parent);
+    {
+        std::lock_guard<NodeBase> lock(*parent);
+        if(parent->version_.load() != version || parent->child(dir) != NULL){
+            delete node;
+            return RETRY;
+        }
+        parent->setChild(dir, node);
+    }
+    size_.fetch_add(1);
+    fixHeightAndRebalance(parent);
+    return ABSENT;
+}
+
+/**
+* Overwrites node's value, bringing it back if it was a routing node.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::setValue(Node* node, const Value& value)
+{
+    {
+        std::lock_guard<NodeBase> lock(*node);
+        if(node->version_.load() & UNLINKED)
+            return RETRY;
+        node->value_ = value;
+        if(node->present_.load())
+            return PRESENT;
+        node->present_.store(true);
+    }
+    size_.fetch_add(1);
+    return ABSENT;
+}
+
+/**
+* Removes node's key. With two children it just becomes a routing node,
+* otherwise it is unlinked from parent.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::removeNode(NodeBase* parent, Node* node)
+{
+    if(!node->present_.load())
+        return ABSENT;
+    if(node->left_.load() != NULL && node->right_.load() != NULL){
+        std::lock_guard<NodeBase> lock(*node);
+        if(node->version_.load() & UNLINKED)
+            return RETRY;
+        if(!node->present_.load())
+            return ABSENT;
+        if(node->left_.load() != NULL && node->right_.load() != NULL){
+            node->present_.store(false);
+            size_.fetch_sub(1);
+            return PRESENT;
+        }
+    }
+    {
+        std::lock_guard<NodeBase> parentLock(*parent);
+        if((parent->version_.load() & UNLINKED) || node->parent_.load() != parent)
+            return RETRY;
+        std::lock_guard<NodeBase> lock(*node);
+        if(!node->present_.load())
+            return ABSENT;
+        if(!attemptUnlink(parent, node)) // Gained a second child meanwhile
+            return RETRY;
+    }
+    size_.fetch_sub(1);
+    fixHeightAndRebalance(parent);
+    return PRESENT;
+}
+
+/**
+* Splices node out, putting its only child (if any) in its place. Fails
+* if node is no longer parent's child or now has two children. The caller
+* holds both locks.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink(NodeBase* parent, Node* node)
+{
+    Node* parentLeft = parent->left_.load();
+    if(parentLeft != node && parent->right_.load() != node)
+        return false;
+    Node* left = node->left_.load();
+    Node* right = node->right_.load();
+    if(left != NULL && right != NULL)
+        return false;
+    Node* splice = left != NULL ? left : right;
+    parent->setChild(parentLeft == node ? -1 : 1, splice);
+    if(splice != NULL)
+        splice->parent_.store(parent);
+    node->version_.store(UNLINKED);
+    node->present_.store(false);
+    retire(node);
+    return true;
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::heightOf(const Node* node)
+{
+    return node == NULL ? 0 : node->height_.load();
+}
+
+/**
+* What node needs: an unlink, a rotation, a new height, or nothing. Reads
+* without locks, so the answer can be stale, but any thread that changes
+* the node afterwards repairs it itself.
+*/
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(const NodeBase* node)
+{
+    Node* left = node->left_.load();
+    Node* right = node->right_.load();
+    if((left == NULL || right == NULL) && !node->present_.load())
+        return UNLINK_REQUIRED;
+    int hL = heightOf(left);
+    int hR = heightOf(right);
+    int diff = hL - hR;
+    if(diff > 1 || diff < -1)
+        return REBALANCE_REQUIRED;
+    int height = (hL > hR ? hL : hR) + 1;
+    return height != node->height_.load() ? height : NOTHING_REQUIRED;
+}
+
+/**
+* Walks up from node, fixing heights, rotating where the AVL property
+* broke and unlinking routing nodes left with one child, until a node
+* needs nothing, then does the same from every node a rotation left for
+* later. Each step locks only the node, or its parent and itself. Serves
+* as both insertFix and removeFix.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(NodeBase* node)
+{
+    std::vector<NodeBase*> later;
+    for(;;){
+        int condition = node == NULL || node == &holder_ ? NOTHING_REQUIRED : nodeCondition(node);
+        if(condition == NOTHING_REQUIRED || (node->version_.load() & UNLINKED)){
+            if(later.empty())
+                return;
+            node = later.back();
+            later.pop_back();
+            continue;
+        }
+        if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED){
+            std::lock_guard<NodeBase> lock(*node);
+            node = fixHeight(node);
+        } else {
+            NodeBase* parent = node->parent_.load();
+            std::lock_guard<NodeBase> parentLock(*parent);
+            if(!(parent->version_.load() & UNLINKED) && node->parent_.load() == parent){
+                std::lock_guard<NodeBase> lock(*node);
+                node = rebalance(parent, static_cast<Node*>(node), later);
+            }
+        }
+    }
+}
+
+/**
+* Sets node's height if that is all it needs. Returns the next node to
+* look at: node itself if it needs more, its parent if the height changed,
+* or NULL. The caller holds node's lock.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeBase*
+ConcurrentAVLTree<Key, Value>::fixHeight(NodeBase* node)
+{
+    if(node == &holder_)
+        return NULL;
+    int condition = nodeCondition(node);
+    if(condition == UNLINK_REQUIRED || condition == REBALANCE_REQUIRED)
+        return node;
+    if(condition == NOTHING_REQUIRED)
+        return NULL;
+    node->height_.store(condition);
+    return node->parent_.load();
+}
+
+/**
+* Repairs n, which is parent's child: unlinks it if it is a routing node
+* with a free side, rotates if it is out of balance, or fixes its height.
+* Returns the next node to look at, like fixHeight. The caller holds
+* parent's and n's locks.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeBase*
+ConcurrentAVLTree<Key, Value>::rebalance(NodeBase* parent, Node* n, std::vector<NodeBase*>& later)
+{
+    Node* left = n->left_.load();
+    Node* right = n->right_.load();
+    if((left == NULL || right == NULL) && !n->present_.load())
+        return attemptUnlink(parent, n) ? fixHeight(parent) : n;
+
+    int hL = heightOf(left);
+    int hR = heightOf(right);
+    if(hL - hR > 1)
+        return rebalanceTo(parent, n, -1, left, hR, later);
+    if(hR - hL > 1)
+        return rebalanceTo(parent, n, 1, right, hL, later);
+    int height = (hL > hR ? hL : hR) + 1;
+    if(height != n->height_.load()){
+        n->height_.store(height);
+        return fixHeight(parent);
+    }
+    return NULL;
+}
+
+/**
+* n's heavy (-1 left, 1 right) child c is taller than its other side, of
+* height hOther, by more than one. Lifts c with a single rotation, or c's
+* inner child with a double one. If the double rotation would leave c
+* unbalanced, fixes c first and leaves n for later.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeBase*
+ConcurrentAVLTree<Key, Value>::rebalanceTo(NodeBase* parent, Node* n, int heavy, Node* c, int hOther,
+                                           std::vector<NodeBase*>& later)
+{
+    std::lock_guard<NodeBase> lock(*c);
+    if(c->height_.load() - hOther <= 1)
+        return n;
+    Node* inner = c->child(-heavy);
+    int hOuter = heightOf(c->child(heavy));
+    if(hOuter >= heightOf(inner))
+        return rotate(parent, n, heavy, c, hOther, hOuter, inner, heightOf(inner), later);
+    {
+        std::lock_guard<NodeBase> innerLock(*inner);
+        int hInner = inner->height_.load();
+        if(hOuter >= hInner)
+            return rotate(parent, n, heavy, c, hOther, hOuter, inner, hInner, later);
+        int hInnerOuter = heightOf(inner->child(heavy));
+        int diff = hOuter - hInnerOuter;
+        if(diff >= -1 && diff <= 1)
+            return rotateDouble(parent, n, heavy, c, hOther, hOuter, inner, hInnerOuter, later);
+    }
+    return rebalanceTo(n, c, -heavy, inner, hOuter, later);
+}
+
+/**
+* Rotates n down away from its heavy side, lifting c into its place under
+* parent. Only n loses keys, so only n's version moves. The heights passed
+* in were read under the locks the caller holds. Returns whichever of n, c
+* or parent still needs work, deepest first, like fixHeight. Fixing n or c
+* may stop short of parent, whose child just changed height, so parent
+* then goes on later too.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeBase*
+ConcurrentAVLTree<Key, Value>::rotate(NodeBase* parent, Node* n, int heavy, Node* c, int hOther, int hOuter,
+                                      Node* inner, int hInner, std::vector<NodeBase*>& later)
+{
+    std::uint64_t version = n->version_.load();
+    int side = parent->left_.load() == n ? -1 : 1;
+    n->version_.store(version | SHRINKING);
+    n->setChild(heavy, inner);
+    if(inner != NULL)
+        inner->parent_.store(n);
+    c->setChild(-heavy, n);
+    n->parent_.store(c);
+    parent->setChild(side, c);
+    c->parent_.store(parent);
+
+    int hN = (hInner > hOther ? hInner : hOther) + 1;
+    n->height_.store(hN);
+    c->height_.store((hOuter > hN ? hOuter : hN) + 1);
+    n->version_.store(version + VERSION_STEP);
+
+    NodeBase* next = NULL;
+    if(hInner - hOther > 1 || hOther - hInner > 1)
+        next = n;
+    else if((inner == NULL || hOther == 0) && !n->present_.load())
+        next = n;
+    else if(hOuter - hN > 1 || hN - hOuter > 1)
+        next = c;
+    else if(hOuter == 0 && !c->present_.load())
+        next = c;
+    else
+        return fixHeight(parent);
+    later.push_back(parent);
+    return next;
+}
+
+/**
+* Rotates c away from inner, then n away from c, so inner ends up under
+* parent with c and n as its children. Both n and c lose keys. The caller
+* checked c stays balanced; if it is a routing node left with a free side,
+* it is unlinked here.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeBase*
+ConcurrentAVLTree<Key, Value>::rotateDouble(NodeBase* parent, Node* n, int heavy, Node* c, int hOther, int hOuter,
+                                            Node* inner, int hInnerOuter, std::vector<NodeBase*>& later)
+{
+    std::uint64_t version = n->version_.load();
+    std::uint64_t cVersion = c->version_.load();
+    int side = parent->left_.load() == n ? -1 : 1;
+    Node* innerOuter = inner->child(heavy);
+    Node* innerInner = inner->child(-heavy);
+    int hInnerInner = heightOf(innerInner);
+    n->version_.store(version | SHRINKING);
+    c->version_.store(cVersion | SHRINKING);
+    n->setChild(heavy, innerInner);
+    if(innerInner != NULL)
+        innerInner->parent_.store(n);
+    c->setChild(-heavy, innerOuter);
+    if(innerOuter != NULL)
+        innerOuter->parent_.store(c);
+    inner->setChild(heavy, c);
+    c->parent_.store(inner);
+    inner->setChild(-heavy, n);
+    n->parent_.store(inner);
+    parent->setChild(side, inner);
+    inner->parent_.store(parent);
+
+    int hN = (hInnerInner > hOther ? hInnerInner : hOther) + 1;
+    n->height_.store(hN);
+    int hC = (hOuter > hInnerOuter ? hOuter : hInnerOuter) + 1;
+    c->height_.store(hC);
+    n->version_.store(version + VERSION_STEP);
+    c->version_.store(cVersion + VERSION_STEP);
+    // A routing c may be left with a free side. Its new parent is inner, and both are locked.
+    if((hOuter == 0 || hInnerOuter == 0) && !c->present_.load() && attemptUnlink(inner, c))
+        hC = hOuter > hInnerOuter ? hOuter : hInnerOuter;
+    inner->height_.store((hC > hN ? hC : hN) + 1);
+
+    NodeBase* next = NULL;
+    if(hInnerInner - hOther > 1 || hOther - hInnerInner > 1)
+        next = n;
+    else if((innerInner == NULL || hOther == 0) && !n->present_.load())
+        next = n;
+    else if(hC - hN > 1 || hN - hC > 1)
+        next = inner;
+    else
+        return fixHeight(parent);
+    later.push_back(parent);
+    return next;
+}
+
+/**
+* Queues an unlinked node to be freed once no thread can be looking at it.
+* Safe to call under node locks: freeing waits until reclaimIfDue.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::retire(Node* node)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retired_.push_back(node);
+    retiredCount_.store(retired_.size());
+}
+
+/**
+* Frees the retired nodes once there is a batch of them. Must be called
+* outside any ReadGuard, or it would wait for itself.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::reclaimIfDue()
+{
+    if(retiredCount_.load() >= CONCURRENT_AVL_RETIRE_BATCH)
+        reclaim();
+}
+
+/**
+* Frees every retired node. Threads that start after the epoch flips can
+* no longer reach them, so only the ones registered under the old epoch
+* need to finish. If another thread is already freeing, leaves the nodes
+* for its next round.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::reclaim()
+{
+    std::unique_lock<std::mutex> reclaiming(reclaimLock_, std::try_to_lock);
+    if(!reclaiming.owns_lock())
+        return;
+    std::vector<Node*> doomed;
+    {
+        std::lock_guard<std::mutex> lock(retireLock_);
+        doomed.swap(retired_);
+        retiredCount_.store(0);
+    }
+    unsigned old = epoch_.fetch_add(1);
+    for(std::size_t i = 0; i < CONCURRENT_AVL_READER_STRIPES; ++i){
+        while(readers_[i].count_[old & 1].load() != 0)
+            std::this_thread::yield();
+    }
+    for(std::size_t i = 0; i < doomed.size(); ++i)
+        delete doomed[i];
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::clearHelper(Node* node)
+{
+    if(node == NULL)
+        return;
+    clearHelper(node->left_.load());
+    clearHelper(node->right_.load());
+    delete node;
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::balancedRec(const Node* node, bool& balanced) const
+{
+    if(node == NULL)
+        return 0;
+    int l = balancedRec(node->left_.load(), balanced);
+    int r = balancedRec(node->right_.load(), balanced);
+    if(l - r > 1 || r - l > 1)
+        balanced = false;
+    return (l > r ? l : r) + 1;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef FROZENMAP_H
+#define FROZENMAP_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "keycompare.h"
+
+/**
+* An immutable sorted map for trees that are built once and then only
+* read. The items are kept in a sorted array for iteration. A second
+* array holds the keys in Eytzinger (BFS) order: the root at index 1 and
+* the children of i at 2i and 2i+1. The top levels of the search share a
+* few cache lines, and the descent has no unpredictable branches.
+*
+* BinarySearchTree::freeze() makes one, ordered by the tree's comparator. Calling
+* assignSorted() again refreezes it in O(n), reusing the storage it
+* already has.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenMap
+{
+public:
+    typedef typename std::vector<std::pair<const Key, Value> >::const_iterator iterator;
+    typedef iterator const_iterator;
+
+    FrozenMap();
+    explicit FrozenMap(const Compare& compare);
+
+    template<typename ForwardIterator>
+    void assignSorted(ForwardIterator first, ForwardIterator last);
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    iterator find(const K& key) const;
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    Value const & operator[](const K& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    void layout(std::size_t i, std::size_t& next);
+    template<typename K>
+    iterator lowerBound(const K& key) const;
+    template<typename K>
+    iterator findKey(const K& key) const;
+
+    std::vector<std::pair<const Key, Value> > items_; // Sorted by key
+    std::vector<Key> keys_;                           // Eytzinger order, keys_[0] unused
+    std::vector<std::size_t> index_;                  // Position in items_ of each keys_ entry
+    KeyCompare<Compare, Key> compare_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the FrozenMap class.
+  ---------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenMap<Key, Value, Compare>::FrozenMap()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenMap<Key, Value, Compare>::FrozenMap(const Compare& compare) : compare_(compare)
+{
+
+}
+
+/**
+* Replaces the contents with the items in [first, last), which must be
+* sorted by strictly increasing key, as any tree iteration is.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIterator>
+void FrozenMap<Key, Value, Compare>::assignSorted(ForwardIterator first, ForwardIterator last)
+{
+    items_.clear();
+    for(; first != last; ++first)
+        items_.push_back(*first);
+
+    std::size_t n = items_.size();
+    index_.assign(n + 1, n); // index_[0] is where a search past the largest key ends up
+    if(n == 0){
+        keys_.clear();
+        return;
+    }
+    keys_.assign(n + 1, items_[0].first);
+    std::size_t next = 0;
+    layout(1, next);
+}
+
+/**
+* Fills the subtree rooted at Eytzinger index i with the next sorted
+* items, in order, so the BFS array ends up describing a search tree.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenMap<Key, Value, Compare>::layout(std::size_t i, std::size_t& next)
+{
+    if(i >= keys_.size())
+        return;
+    layout(2 * i, next);
+    keys_[i] = items_[next].first;
+    index_[i] = next++;
+    layout(2 * i + 1, next);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::begin() const
+{
+    return items_.begin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::end() const
+{
+    return items_.end();
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*
+* Each step goes to child 2k or 2k+1 depending on one comparison, so the
+* compiler emits a conditional move rather than a branch. The cache line
+* holding the descendants four levels down is prefetched while the
+* current level is compared. Once k falls off the bottom, its trailing
+* 1 bits are the right turns taken since the answer. Dropping them and
+* one more bit leads back to the answer, or to 0 if every turn was right.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return lowerBound(key);
+}
+
+/**
+* lower_bound for any type a transparent Compare takes, see keycompare.h.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::lower_bound(const K& key) const
+{
+    return lowerBound(key);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::lowerBound(const K& key) const
+{
+    const std::size_t n = items_.size();
+    const Key* keys = keys_.data();
+    std::size_t k = 1;
+    while(k <= n){
+#if defined(__GNUC__)
+        __builtin_prefetch(keys + ((16 * k) & -(std::size_t)(16 * k <= n)));
+#endif
+        k = 2 * k + compare_.less(keys[k], key);
+    }
+    while(k & 1)
+        k >>= 1;
+    k >>= 1;
+    return items_.begin() + index_[k];
+}
+
+/**
+* Returns an iterator to the item with the given key, or end() if key
+* is not in the map.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::find(const Key& key) const
+{
+    return findKey(key);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::find(const K& key) const
+{
+    return findKey(key);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+typename FrozenMap<Key, Value, Compare>::iterator
+FrozenMap<Key, Value, Compare>::findKey(const K& key) const
+{
+    iterator it = lowerBound(key);
+    if(it != items_.end() && compare_.less(key, it->first))
+        return items_.end();
+    return it;
+}
+
+/**
+* Returns the value for key, or throws std::out_of_range if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+Value const & FrozenMap<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == items_.end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename>
+Value const & FrozenMap<Key, Value, Compare>::operator[](const K& key) const
+{
+    iterator it = findKey(key);
+    if(it == items_.end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenMap<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+/*
+  -------------------------------------------
+  End implementations for the FrozenMap class.
+  -------------------------------------------
+*/
+
+#endif
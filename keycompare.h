@@ -0,0 +1,146 @@
+#ifndef KEYCOMPARE_H
+#define KEYCOMPARE_H
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include "opstats.h"
+
+/**
+ * How the trees order their keys. Compare is a strict weak ordering, like
+ * std::map's: compare(a, b) is true when a goes before b. A comparator can
+ * also have a three-way member, compare.compare(a, b), returning a negative,
+ * zero or positive int. Exact-match descents then use it to stop at the
+ * key, while a plain less-than has to go on to a leaf and check for
+ * equality once at the end. Either way a descent makes one call per node.
+ *
+ * A comparator with an is_transparent member type, like C++14's
+ * std::less<>, can also compare keys with other types, such as a
+ * std::string key with a const char*. The trees then take any such type
+ * in find, lower_bound, remove and operator[], and look it up without
+ * building a Key. A transparent three-way comparator needs compare()
+ * overloads for the mixed types too.
+ *
+ * Every call counts as one STAT_COMPARISONS, see opstats.h.
+ */
+template <typename Compare, typename Key>
+class KeyCompare
+{
+    template<typename C>
+    static auto hasCompare(int) -> decltype(
+        static_cast<int>(std::declval<const C&>().compare(std::declval<const Key&>(), std::declval<const Key&>())),
+        std::true_type());
+    template<typename C>
+    static std::false_type hasCompare(...);
+
+public:
+    static const bool threeWay = decltype(hasCompare<Compare>(0))::value;
+
+    KeyCompare();
+    explicit KeyCompare(const Compare& compare);
+
+    template<typename A, typename B>
+    bool less(const A& a, const B& b) const;
+    template<typename A, typename B>
+    int order(const A& a, const B& b) const;
+    const Compare& get() const;
+
+private:
+    template<typename A, typename B>
+    int order(std::true_type, const A& a, const B& b) const;
+    template<typename A, typename B>
+    int order(std::false_type, const A& a, const B& b) const;
+
+    Compare compare_;
+};
+
+/**
+ * TransparentKey<Compare, K>::type is K when Compare is transparent, and
+ * missing otherwise, so the lookup overloads for other key types drop out
+ * of overload resolution for ordinary comparators.
+ */
+template <typename Compare, typename K, typename = void>
+struct TransparentKey
+{
+};
+
+template <typename Compare, typename K>
+struct TransparentKey<Compare, K, typename std::conditional<true, void, typename Compare::is_transparent>::type>
+{
+    typedef K type;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the KeyCompare class.
+  ---------------------------------------------
+*/
+
+template<typename Compare, typename Key>
+const bool KeyCompare<Compare, Key>::threeWay;
+
+template<typename Compare, typename Key>
+KeyCompare<Compare, Key>::KeyCompare() : compare_()
+{
+
+}
+
+template<typename Compare, typename Key>
+KeyCompare<Compare, Key>::KeyCompare(const Compare& compare) : compare_(compare)
+{
+
+}
+
+/**
+* True if a goes before b.
+*/
+template<typename Compare, typename Key>
+template<typename A, typename B>
+bool KeyCompare<Compare, Key>::less(const A& a, const B& b) const
+{
+    BST_STAT(STAT_COMPARISONS, 1);
+    return compare_(a, b);
+}
+
+/**
+* Negative if a goes before b, positive if after, zero if they are
+* equivalent. Takes one call with a three-way comparator and up to two
+* without, so the descents only use it when threeWay is set.
+*/
+template<typename Compare, typename Key>
+template<typename A, typename B>
+int KeyCompare<Compare, Key>::order(const A& a, const B& b) const
+{
+    return order(std::integral_constant<bool, threeWay>(), a, b);
+}
+
+template<typename Compare, typename Key>
+template<typename A, typename B>
+int KeyCompare<Compare, Key>::order(std::true_type, const A& a, const B& b) const
+{
+    BST_STAT(STAT_COMPARISONS, 1);
+    return compare_.compare(a, b);
+}
+
+template<typename Compare, typename Key>
+template<typename A, typename B>
+int KeyCompare<Compare, Key>::order(std::false_type, const A& a, const B& b) const
+{
+    if(less(a, b))
+        return -1;
+    return less(b, a) ? 1 : 0;
+}
+
+template<typename Compare, typename Key>
+const Compare& KeyCompare<Compare, Key>::get() const
+{
+    return compare_;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the KeyCompare class.
+  -------------------------------------------
+*/
+
+#endif
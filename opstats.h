@@ -0,0 +1,201 @@
+#ifndef OPSTATS_H
+#define OPSTATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * Operation counters for BinarySearchTree and its subclasses.
+ *
+ * The trees bump them through BST_STAT, which compiles to nothing unless
+ * BST_STATS is defined, so a normal build pays nothing. Comparisons are
+ * counted by KeyCompare, see keycompare.h.
+ * With BST_STATS, each thread counts into its own block with plain
+ * relaxed loads and stores, and readStats() adds the blocks up. Counts
+ * are process-wide, not per tree.
+ */
+enum OpStat
+{
+    STAT_SEARCHES,          // Descents from the root: lookups, inserts, removes
+    STAT_COMPARISONS,       // Comparator calls
+    STAT_NODES_VISITED,     // Nodes stepped onto on the way down
+    STAT_SINGLE_ROTATIONS,  // Rebalancing cases fixed with one rotate
+    STAT_DOUBLE_ROTATIONS,  // Rebalancing cases fixed with two
+    STAT_INSERT_FIX_STEPS,  // Levels insertFix went up
+    STAT_REMOVE_FIX_STEPS,  // Levels removeFix went up
+    STAT_NODE_SWAPS,        // nodeSwap calls
+    STAT_COUNT
+};
+
+/**
+ * A snapshot of every counter, indexed by OpStat.
+ */
+struct OpStats
+{
+    unsigned long long count[STAT_COUNT];
+};
+
+/**
+ * One thread's counters. Only the owning thread writes them, so a bump
+ * needs no atomic read-modify-write; the atomics only make the reads from
+ * readStats() well defined. A block folds itself into the registry's
+ * retired totals when its thread exits.
+ */
+class OpStatsBlock
+{
+public:
+    OpStatsBlock();
+    ~OpStatsBlock();
+
+    void bump(OpStat which, unsigned long long n);
+
+    std::atomic<unsigned long long> count[STAT_COUNT];
+};
+
+/**
+ * The blocks of the live threads and the totals of the ones that exited.
+ */
+struct OpStatsRegistry
+{
+    OpStatsRegistry();
+
+    std::mutex lock;
+    std::vector<OpStatsBlock*> live;
+    OpStats retired;
+
+    static OpStatsRegistry& instance();
+};
+
+OpStatsBlock& localStats();
+void bumpStat(OpStat which, unsigned long long n = 1);
+OpStats readStats();
+void resetStats();
+void dumpStats(std::ostream& out);
+
+#ifdef BST_STATS
+#define BST_STAT(which, n) bumpStat(which, n)
+#else
+#define BST_STAT(which, n) ((void)0)
+#endif
+
+/*
+  ----------------------------------------------
+  Begin implementations for the OpStats functions.
+  ----------------------------------------------
+*/
+
+inline OpStatsBlock::OpStatsBlock()
+{
+    for(int i = 0; i < STAT_COUNT; ++i)
+        count[i].store(0, std::memory_order_relaxed);
+    OpStatsRegistry& registry = OpStatsRegistry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.live.push_back(this);
+}
+
+inline OpStatsBlock::~OpStatsBlock()
+{
+    OpStatsRegistry& registry = OpStatsRegistry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    for(int i = 0; i < STAT_COUNT; ++i)
+        registry.retired.count[i] += count[i].load(std::memory_order_relaxed);
+    for(std::size_t i = 0; i < registry.live.size(); ++i){
+        if(registry.live[i] == this){
+            registry.live[i] = registry.live.back();
+            registry.live.pop_back();
+            break;
+        }
+    }
+}
+
+inline void OpStatsBlock::bump(OpStat which, unsigned long long n)
+{
+    count[which].store(count[which].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline OpStatsRegistry::OpStatsRegistry() : retired()
+{
+
+}
+
+inline OpStatsRegistry& OpStatsRegistry::instance()
+{
+    static OpStatsRegistry registry;
+    return registry;
+}
+
+/**
+ * The calling thread's block, registered on first use.
+ */
+inline OpStatsBlock& localStats()
+{
+    static thread_local OpStatsBlock block;
+    return block;
+}
+
+inline void bumpStat(OpStat which, unsigned long long n)
+{
+    localStats().bump(which, n);
+}
+
+/**
+ * Totals over every thread, live or exited. Counts from threads that are
+ * still running may be a few bumps behind.
+ */
+inline OpStats readStats()
+{
+    OpStatsRegistry& registry = OpStatsRegistry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    OpStats stats = registry.retired;
+    for(std::size_t i = 0; i < registry.live.size(); ++i)
+        for(int j = 0; j < STAT_COUNT; ++j)
+            stats.count[j] += registry.live[i]->count[j].load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * Zeroes every counter. Bumps racing with this may survive it, so reset
+ * while the trees are quiet.
+ */
+inline void resetStats()
+{
+    OpStatsRegistry& registry = OpStatsRegistry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.retired = OpStats();
+    for(std::size_t i = 0; i < registry.live.size(); ++i)
+        for(int j = 0; j < STAT_COUNT; ++j)
+            registry.live[i]->count[j].store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Writes every counter as a "name value" line, then the per-search ratios.
+ */
+inline void dumpStats(std::ostream& out)
+{
+#ifndef BST_STATS
+    out << "# operation counters are off, rebuild with -DBST_STATS" << std::endl;
+#endif
+    static const char* const names[STAT_COUNT] = {
+        "searches", "comparisons", "nodes_visited", "single_rotations",
+        "double_rotations", "insert_fix_steps", "remove_fix_steps", "node_swaps"
+    };
+    OpStats stats = readStats();
+    for(int i = 0; i < STAT_COUNT; ++i)
+        out << names[i] << " " << stats.count[i] << std::endl;
+    if(stats.count[STAT_SEARCHES] > 0){
+        double searches = static_cast<double>(stats.count[STAT_SEARCHES]);
+        out << "comparisons_per_search " << stats.count[STAT_COMPARISONS] / searches << std::endl;
+        out << "nodes_per_search " << stats.count[STAT_NODES_VISITED] / searches << std::endl;
+    }
+}
+
+/*
+  --------------------------------------------
+  End implementations for the OpStats functions.
+  --------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,579 @@
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* A persistent AVL tree: nodes are never changed once built. insert and
+* remove copy just the O(log n) nodes on the path they touch and share
+* every other subtree with the previous version. Nodes are reference
+* counted, so a version lives exactly as long as something still uses it.
+*
+* snapshot() returns the current version in O(1). A Snapshot never
+* changes and may be read from any thread without locks while the tree
+* keeps taking updates. The tree itself expects one writer at a time;
+* snapshot() may be called from any thread.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+protected:
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+
+        const std::pair<const Key, Value> item_;
+        const NodePtr left_;
+        const NodePtr right_;
+        const int height_;
+    };
+
+public:
+    /**
+    * A forward iterator over one version, in key order. It keeps that
+    * version alive, even after its Snapshot is gone.
+    */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        explicit iterator(const NodePtr& root);
+        void pushLeft(const Node* node);
+
+        NodePtr root_;
+        std::vector<const Node*> stack_;  // Nodes still to visit, next one on top
+    };
+
+    /**
+    * One immutable version of the tree.
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        Value const & operator[](const Key& key) const;
+        std::size_t size() const;
+        bool empty() const;
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        Snapshot(const NodePtr& root, std::size_t size);
+
+        NodePtr root_;
+        std::size_t size_;
+    };
+
+    PersistentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+    // Reads of the current version, for the writer's own thread
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    static int heightOf(const NodePtr& node);
+    static NodePtr makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+    static NodePtr balance(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+    static NodePtr insertHelper(const NodePtr& node, const std::pair<const Key, Value>& keyValuePair, bool& inserted);
+    static NodePtr removeHelper(const NodePtr& node, const Key& key, bool& removed);
+    static NodePtr removeLargest(const NodePtr& node);
+    static int balancedRec(const NodePtr& node, bool& balanced);
+    void publish(const NodePtr& root, std::size_t size);
+
+private:
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+
+protected:
+    Snapshot current_;
+    mutable std::mutex publishLock_;  // Held only while current_ is copied or replaced
+};
+
+/*
+  ----------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Node class.
+  ----------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Node::Node(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_((heightOf(left) > heightOf(right) ? heightOf(left) : heightOf(right)) + 1)
+{
+
+}
+
+/*
+  --------------------------------------------------------
+  End implementations for the PersistentAVLTree::Node class.
+  --------------------------------------------------------
+*/
+
+/*
+  --------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::iterator class.
+  --------------------------------------------------------------
+*/
+
+/**
+* A default constructor that makes an end iterator.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::iterator::iterator()
+{
+
+}
+
+/**
+* Holds on to root and starts at its smallest item.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::iterator::iterator(const NodePtr& root) :
+    root_(root)
+{
+    pushLeft(root.get());
+}
+
+/**
+* Pushes node and its chain of left children, so the smallest ends on top.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeft(const Node* node)
+{
+    while(node != NULL){
+        stack_.push_back(node);
+        node = node->left_.get();
+    }
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key,Value> &
+PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return stack_.back()->item_;
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key,Value> *
+PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(stack_.back()->item_);
+}
+
+template<typename Key, typename Value>
+bool
+PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(stack_.empty() || rhs.stack_.empty())
+        return stack_.empty() && rhs.stack_.empty();
+    return stack_.back() == rhs.stack_.back();
+}
+
+template<typename Key, typename Value>
+bool
+PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator&
+PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+    const Node* done = stack_.back();
+    stack_.pop_back();
+    pushLeft(done->right_.get());
+    return *this;
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/*
+  ------------------------------------------------------------
+  End implementations for the PersistentAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+/*
+  --------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  --------------------------------------------------------------
+*/
+
+/**
+* An empty version.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot() :
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const NodePtr& root, std::size_t size) :
+    root_(root),
+    size_(size)
+{
+
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::Snapshot::begin() const
+{
+    return iterator(root_);
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::Snapshot::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(). The
+* iterator's stack holds the nodes where the search went left, which are
+* exactly the ones still to visit after the found item.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    iterator it;
+    const Node* temp = root_.get();
+    while(temp != NULL){
+        if(key > temp->item_.first)
+            temp = temp->right_.get();
+        else if(key < temp->item_.first){
+            it.stack_.push_back(temp);
+            temp = temp->left_.get();
+        } else { // Found key
+            it.stack_.push_back(temp);
+            it.root_ = root_;
+            return it;
+        }
+    }
+    return iterator();
+}
+
+template<typename Key, typename Value>
+Value const & PersistentAVLTree<Key, Value>::Snapshot::operator[](const Key& key) const
+{
+    const Node* temp = root_.get();
+    while(temp != NULL){
+        if(key > temp->item_.first)
+            temp = temp->right_.get();
+        else if(key < temp->item_.first)
+            temp = temp->left_.get();
+        else
+            return temp->item_.second;
+    }
+    throw std::out_of_range("Invalid key");
+}
+
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::Snapshot::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::Snapshot::empty() const
+{
+    return root_ == NULL;
+}
+
+/*
+  ------------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  ------------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree()
+{
+
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present,
+* as a new version. Returns whether the key was newly added.
+*/
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool inserted = false;
+    NodePtr root = insertHelper(current_.root_, keyValuePair, inserted);
+    publish(root, current_.size_ + (inserted ? 1 : 0));
+    return inserted;
+}
+
+/**
+* Removes the item with the given key as a new version. Returns whether
+* there was one; if not, the current version is kept as it is.
+*/
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    bool removed = false;
+    NodePtr root = removeHelper(current_.root_, key, removed);
+    if(removed)
+        publish(root, current_.size_ - 1);
+    return removed;
+}
+
+/**
+* Starts a new, empty version. Nodes still used by snapshots stay alive.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    publish(NodePtr(), 0);
+}
+
+/**
+* Returns the current version in O(1).
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot
+PersistentAVLTree<Key, Value>::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(publishLock_);
+    return current_;
+}
+
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::publish(const NodePtr& root, std::size_t size)
+{
+    Snapshot old; // Let the old version go after the lock is released
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        old = current_;
+        current_ = Snapshot(root, size);
+    }
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::begin() const
+{
+    return current_.begin();
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::end() const
+{
+    return current_.end();
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    return current_.find(key);
+}
+
+template<typename Key, typename Value>
+Value const & PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    return current_[key];
+}
+
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return current_.size();
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return current_.empty();
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::isBalanced() const
+{
+    bool balanced = true;
+    balancedRec(current_.root_, balanced);
+    return balanced;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::heightOf(const NodePtr& node)
+{
+    return node == NULL ? 0 : node->height_;
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    return std::make_shared<Node>(item, left, right);
+}
+
+/**
+* Builds a node with the given item and subtrees, whose heights differ by
+* at most 2, rotating as it goes so the result is balanced. Rotations
+* build new nodes too, so the subtrees passed in are never touched.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    int diff = heightOf(left) - heightOf(right);
+    if(diff > 1){ // Left heavy
+        if(heightOf(left->left_) >= heightOf(left->right_)) // Single rotation
+            return makeNode(left->item_, left->left_, makeNode(item, left->right_, right));
+        const NodePtr& lr = left->right_; // Zig-zag, its inner grandchild comes up
+        return makeNode(lr->item_, makeNode(left->item_, left->left_, lr->left_), makeNode(item, lr->right_, right));
+    }
+    if(diff < -1){ // Right heavy
+        if(heightOf(right->right_) >= heightOf(right->left_))
+            return makeNode(right->item_, makeNode(item, left, right->left_), right->right_);
+        const NodePtr& rl = right->left_;
+        return makeNode(rl->item_, makeNode(item, left, rl->left_), makeNode(right->item_, rl->right_, right->right_));
+    }
+    return makeNode(item, left, right);
+}
+
+/**
+* Returns a copy of the subtree at node with the item in it.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::insertHelper(const NodePtr& node, const std::pair<const Key, Value>& keyValuePair, bool& inserted)
+{
+    if(node == NULL){
+        inserted = true;
+        return makeNode(keyValuePair, NodePtr(), NodePtr());
+    }
+    if(keyValuePair.first < node->item_.first)
+        return balance(node->item_, insertHelper(node->left_, keyValuePair, inserted), node->right_);
+    if(keyValuePair.first > node->item_.first)
+        return balance(node->item_, node->left_, insertHelper(node->right_, keyValuePair, inserted));
+    return makeNode(keyValuePair, node->left_, node->right_); // Overwrite
+}
+
+/**
+* Returns a copy of the subtree at node without key, or node itself if
+* key is not in it. A node with two children is replaced by its
+* predecessor.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeHelper(const NodePtr& node, const Key& key, bool& removed)
+{
+    if(node == NULL)
+        return node;
+    if(key < node->item_.first){
+        NodePtr left = removeHelper(node->left_, key, removed);
+        return removed ? balance(node->item_, left, node->right_) : node;
+    }
+    if(key > node->item_.first){
+        NodePtr right = removeHelper(node->right_, key, removed);
+        return removed ? balance(node->item_, node->left_, right) : node;
+    }
+    removed = true;
+    if(node->left_ == NULL)
+        return node->right_;
+    if(node->right_ == NULL)
+        return node->left_;
+    const Node* pred = node->left_.get();
+    while(pred->right_ != NULL)
+        pred = pred->right_.get();
+    return balance(pred->item_, removeLargest(node->left_), node->right_);
+}
+
+/**
+* Returns a copy of the subtree at node without its largest item.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeLargest(const NodePtr& node)
+{
+    if(node->right_ == NULL)
+        return node->left_;
+    return balance(node->item_, node->left_, removeLargest(node->right_));
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::balancedRec(const NodePtr& node, bool& balanced)
+{
+    if(node == NULL)
+        return 0;
+    int l = balancedRec(node->left_, balanced);
+    int r = balancedRec(node->right_, balanced);
+    if(l - r > 1 || r - l > 1)
+        balanced = false;
+    return (l > r ? l : r) + 1;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,567 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds the colour as a data member. The
+* colour takes one byte, which fits in the padding after Node's members
+* just as AVLNode's balance does, so the two nodes are the same size.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructor/destructor. New nodes are red.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    template<typename... Args>
+    RBNode(RBNode<Key, Value>* parent, Args&&... args);
+    ~RBNode();
+
+    // Getter/setter for the node's colour.
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Redefined to return RBNodes, for the same reasons as in AVLNode.
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+
+/**
+* A constructor that forwards args on to build the item in place.
+*/
+template<class Key, class Value>
+template<typename... Args>
+RBNode<Key, Value>::RBNode(RBNode<Key, Value> *parent, Args&&... args) :
+    Node<Key, Value>(parent, std::forward<Args>(args)...), red_(true)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A red-black tree, with the same interface as AVLTree for inserting,
+* removing, bulk loading and freezing, so either can stand in for the
+* other. Its height can reach 2 log2(n+1) against AVL's 1.44 log2(n+2),
+* but rebalancing is cheaper: an insert makes at most 2 rotations and a
+* remove at most 3, where an AVL remove can rotate at every level. Only
+* recolouring goes further up, O(1) amortized.
+*
+* Arena and Compare are as in BinarySearchTree. The AVLTree extras that
+* depend on its height bookkeeping (split, join, the set algebra, building
+* subtrees in parallel and order statistics) have no counterpart here.
+*/
+template <class Key, class Value, class Arena = HeapArena, class Compare = std::less<Key> >
+class RedBlackTree : public BinarySearchTree<Key, Value, Arena, Compare>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Arena, Compare>::iterator iterator;
+
+    RedBlackTree();
+    explicit RedBlackTree(const Compare& compare);
+    virtual ~RedBlackTree();
+    using BinarySearchTree<Key, Value, Arena, Compare>::insert;
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    virtual iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    virtual void clear();
+    virtual bool isBalanced() const;
+    template<typename ForwardIterator>
+    void assignSorted(ForwardIterator first, ForwardIterator last, unsigned threads = 1);
+    template<typename InputIterator>
+    void buildFrom(InputIterator first, InputIterator last, unsigned threads = 1);
+
+protected:
+    typedef RBNode<Key, Value> NodeType;
+
+    NodeType* getRoot() const;
+    void nodeSwap(NodeType* n1, NodeType* n2);
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual std::pair<iterator, bool> insertCopy(const std::pair<const Key, Value>& keyValuePair);
+    virtual iterator insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insertBalance(std::pair<NodeType*, bool> result);
+    void insertFix(NodeType* n);
+    void removeFix(NodeType* p, bool left);
+    void rotate(NodeType* n, int heavy);
+    static bool isRed(const NodeType* node);
+    int blackHeight(const NodeType* root) const;
+    template<typename ForwardIterator>
+    NodeType* buildSorted(ForwardIterator& it, std::size_t n, int depth, int redDepth);
+};
+
+/*
+  --------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  --------------------------------------------
+*/
+
+template<class Key, class Value, class Arena, class Compare>
+RedBlackTree<Key, Value, Arena, Compare>::RedBlackTree()
+{
+
+}
+
+/*
+ * Constructs an empty tree that orders its keys with compare.
+ */
+template<class Key, class Value, class Arena, class Compare>
+RedBlackTree<Key, Value, Arena, Compare>::RedBlackTree(const Compare& compare) :
+    BinarySearchTree<Key, Value, Arena, Compare>(compare)
+{
+
+}
+
+/*
+ * Frees the nodes here, while the tree still knows they are RBNodes.
+ */
+template<class Key, class Value, class Arena, class Compare>
+RedBlackTree<Key, Value, Arena, Compare>::~RedBlackTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::clear()
+{
+    this->template clearNodes<NodeType>();
+}
+
+/*
+ * O(n): checks the red-black rules themselves, that no red node has a
+ * red child and every path down from a node meets the same number of
+ * black nodes. They bound the height by 2 log2(n+1). The stricter AVL
+ * rule that BinarySearchTree::isBalanced checks need not hold.
+ */
+template<class Key, class Value, class Arena, class Compare>
+bool RedBlackTree<Key, Value, Arena, Compare>::isBalanced() const
+{
+    return !isRed(getRoot()) && blackHeight(getRoot()) >= 0;
+}
+
+//Black nodes on every path from root down to a leaf, or -1 if the paths
+//disagree or a red node has a red child. Recursion is only O(log n) deep
+//in a tree that keeps the rules, and stops at the first level that breaks them.
+template<class Key, class Value, class Arena, class Compare>
+int RedBlackTree<Key, Value, Arena, Compare>::blackHeight(const NodeType* root) const
+{
+    if(root == NULL)
+        return 0;
+    if(root->isRed() && (isRed(root->getLeft()) || isRed(root->getRight())))
+        return -1;
+    int left = blackHeight(root->getLeft());
+    if(left < 0 || left != blackHeight(root->getRight()))
+        return -1;
+    return left + (root->isRed() ? 0 : 1);
+}
+
+/*
+ * Every node in a RedBlackTree is an RBNode, so the root can be cast statically.
+ */
+template<class Key, class Value, class Arena, class Compare>
+typename RedBlackTree<Key, Value, Arena, Compare>::NodeType*
+RedBlackTree<Key, Value, Arena, Compare>::getRoot() const
+{
+    return static_cast<NodeType*>(this->root_);
+}
+
+/*
+ * Missing children count as black.
+ */
+template<class Key, class Value, class Arena, class Compare>
+bool RedBlackTree<Key, Value, Arena, Compare>::isRed(const NodeType* node)
+{
+    return node != NULL && node->isRed();
+}
+
+/*
+ * If key is already in the tree, the value is overwritten.
+ */
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertBalance(this->template insertItem<NodeType>(std::move(keyValuePair)));
+}
+
+/*
+ * See the hinted BinarySearchTree::insert.
+ */
+template<class Key, class Value, class Arena, class Compare>
+typename RedBlackTree<Key, Value, Arena, Compare>::iterator
+RedBlackTree<Key, Value, Arena, Compare>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertBalance(this->template insertItem<NodeType>(hint, std::move(keyValuePair))).first;
+}
+
+/*
+ * The copying inserts, see BinarySearchTree::insertCopy.
+ */
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::insertCopy(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertBalance(this->template insertItem<NodeType>(this->copiedItem(keyValuePair)));
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename RedBlackTree<Key, Value, Arena, Compare>::iterator
+RedBlackTree<Key, Value, Arena, Compare>::insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertBalance(this->template insertItem<NodeType>(hint, this->copiedItem(keyValuePair))).first;
+}
+
+/*
+ * See BinarySearchTree::emplace. Redefined so the tree gets RBNodes and stays balanced.
+ */
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::emplace(Args&&... args)
+{
+    return insertBalance(this->template emplaceItem<NodeType>(std::forward<Args>(args)...));
+}
+
+/*
+ * See BinarySearchTree::try_emplace. Redefined for the same reasons as above.
+ */
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return insertBalance(this->template tryEmplaceItem<NodeType>(key, std::forward<Args>(args)...));
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return insertBalance(this->template tryEmplaceItem<NodeType>(std::move(key), std::forward<Args>(args)...));
+}
+
+/*
+ * Rebalances after one of the insert cores, if it added a new (red) leaf,
+ * and turns its result into the iterator/bool pair the public functions return.
+ */
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename RedBlackTree<Key, Value, Arena, Compare>::iterator, bool>
+RedBlackTree<Key, Value, Arena, Compare>::insertBalance(std::pair<NodeType*, bool> result)
+{
+    if(result.second)
+        insertFix(result.first);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/*
+ * n is red and may have a red parent. While the uncle is red too, the
+ * grandparent takes the red from both and the problem moves two levels up.
+ * Otherwise one rotation (or two, if n is an inner grandchild) ends it.
+ */
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::insertFix(NodeType* n)
+{
+    while(true) {
+        NodeType* p = n->getParent();
+        if(p == NULL){ // n is the root, which is always black
+            n->setRed(false);
+            return;
+        }
+        if(!p->isRed())
+            return;
+        BST_STAT(STAT_INSERT_FIX_STEPS, 1);
+        NodeType* g = p->getParent(); // p is red, so it is not the root
+        bool parentLeft = g->getLeft() == p;
+        NodeType* u = parentLeft ? g->getRight() : g->getLeft();
+        if(isRed(u)){ // Recolour and go up
+            p->setRed(false);
+            u->setRed(false);
+            g->setRed(true);
+            n = g;
+            continue;
+        }
+        if((p->getLeft() == n) != parentLeft){ // Zig-zag, rotate n above p first
+            BST_STAT(STAT_DOUBLE_ROTATIONS, 1);
+            rotate(p, parentLeft ? 1 : -1);
+            p = n;
+        } else // Zig-zig
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+        rotate(g, parentLeft ? -1 : 1);
+        p->setRed(false);
+        g->setRed(true);
+        return;
+    }
+}
+
+/*
+ * Unlinks node after swapping it with its predecessor if it has two
+ * children, as in BinarySearchTree. Taking out a red node, or a black one
+ * with a (necessarily red) child to blacken, leaves the rules intact;
+ * taking out a black leaf leaves its side of the parent one black short.
+ */
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::removeNode(Node<Key, Value>* node)
+{
+    NodeType* temp = static_cast<NodeType*>(node);
+    if(temp->getLeft() != NULL && temp->getRight() != NULL) // If has both children
+        nodeSwap(temp, static_cast<NodeType*>(this->predecessor(temp)));
+    NodeType* p = temp->getParent();
+    NodeType* child = temp->getLeft() != NULL ? temp->getLeft() : temp->getRight();
+    bool isLeftChild = p != NULL && p->getLeft() == temp;
+    if(child != NULL)
+        child->setParent(p);
+    if(p == NULL)
+        this->root_ = child;
+    else if(isLeftChild)
+        p->setLeft(child);
+    else
+        p->setRight(child);
+    if(!temp->isRed()){
+        if(child != NULL)
+            child->setRed(false);
+        else if(p != NULL)
+            removeFix(p, isLeftChild);
+    }
+    this->detachNode(temp);
+    this->destroyNode(temp);
+}
+
+/*
+ * p's left (or right, if !left) subtree has one black fewer than the
+ * other. A red sibling is rotated up first (one rotation), so the sibling
+ * is black. A black sibling with two black children turns red, which
+ * fixes p's subtree but makes it one black short in turn, so the fix goes
+ * up unless p was red. Otherwise one or two more rotations borrow a red
+ * nephew and finish, for at most three rotations in all.
+ */
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::removeFix(NodeType* p, bool left)
+{
+    while(true) {
+        BST_STAT(STAT_REMOVE_FIX_STEPS, 1);
+        NodeType* s = left ? p->getRight() : p->getLeft(); // Not NULL, its side has a black to spare
+        if(s->isRed()){ // Red sibling
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+            rotate(p, left ? 1 : -1);
+            s->setRed(false);
+            p->setRed(true);
+            s = left ? p->getRight() : p->getLeft();
+        }
+        NodeType* nearChild = left ? s->getLeft() : s->getRight();
+        NodeType* farChild = left ? s->getRight() : s->getLeft();
+        if(!isRed(nearChild) && !isRed(farChild)){ // Black sibling, black nephews
+            s->setRed(true);
+            if(p->isRed()){
+                p->setRed(false);
+                return;
+            }
+            NodeType* g = p->getParent();
+            if(g == NULL)
+                return;
+            left = g->getLeft() == p;
+            p = g;
+            continue;
+        }
+        if(!isRed(farChild)){ // Only the near nephew is red, rotate it above s first
+            BST_STAT(STAT_DOUBLE_ROTATIONS, 1);
+            rotate(s, left ? -1 : 1);
+            nearChild->setRed(false);
+            s->setRed(true);
+            farChild = s;
+            s = nearChild;
+        } else
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+        rotate(p, left ? 1 : -1); // s takes p's place and colour
+        s->setRed(p->isRed());
+        p->setRed(false);
+        farChild->setRed(false);
+        return;
+    }
+}
+
+// If heavy = -1 then it's rotate right, if heavy = 1 then it's rotate left
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::rotate(NodeType* n, int heavy)
+{
+    NodeType* p = n->getParent();
+    NodeType* c = heavy == -1 ? n->getLeft() : n->getRight();
+    if(p == NULL)
+        this->root_ = c;
+    else if(p->getLeft() == n)
+        p->setLeft(c);
+    else
+        p->setRight(c);
+    c->setParent(p);
+    n->setParent(c);
+    if(heavy == -1){
+        n->setLeft(c->getRight());
+        c->setRight(n);
+        if(n->getLeft() != NULL)
+            n->getLeft()->setParent(n);
+    } else {
+        n->setRight(c->getLeft());
+        c->setLeft(n);
+        if(n->getRight() != NULL)
+            n->getRight()->setParent(n);
+    }
+}
+
+/*
+ * Swaps the positions of two nodes, and their colours with them, so each
+ * position keeps its colour.
+ */
+template<class Key, class Value, class Arena, class Compare>
+void RedBlackTree<Key, Value, Arena, Compare>::nodeSwap(NodeType* n1, NodeType* n2)
+{
+    BinarySearchTree<Key, Value, Arena, Compare>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), which
+ * must be sorted by strictly increasing key, in one linear pass with no
+ * rotations. Halving the items at each level leaves every missing child
+ * at depth d or d+1, for d = floor(log2(n+1)). Colouring the nodes at
+ * depth d red and the rest black gives every path d black nodes.
+ * threads is taken so calls written for AVLTree build here too; the pass
+ * runs on the calling thread.
+ */
+template<class Key, class Value, class Arena, class Compare>
+template<typename ForwardIterator>
+void RedBlackTree<Key, Value, Arena, Compare>::assignSorted(ForwardIterator first, ForwardIterator last, unsigned)
+{
+    clear();
+    std::size_t n = std::distance(first, last);
+    int redDepth = 0;
+    while((std::size_t(2) << redDepth) <= n + 1)
+        ++redDepth;
+    this->root_ = buildSorted(first, n, 0, redDepth);
+    this->rethread();
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename ForwardIterator>
+typename RedBlackTree<Key, Value, Arena, Compare>::NodeType*
+RedBlackTree<Key, Value, Arena, Compare>::buildSorted(ForwardIterator& it, std::size_t n, int depth, int redDepth)
+{
+    if(n == 0)
+        return NULL;
+    NodeType* left = buildSorted(it, n / 2, depth + 1, redDepth);
+    NodeType* node = NULL;
+    NodeType* right = NULL;
+    try {
+        node = this->createNode(static_cast<NodeType*>(NULL), *it);
+        ++it;
+        right = buildSorted(it, n - 1 - n / 2, depth + 1, redDepth);
+    } catch(...) { // Don't leak what was already built
+        this->clearHelper(left);
+        if(node != NULL)
+            this->destroyNode(node);
+        throw;
+    }
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != NULL)
+        left->setParent(node);
+    if(right != NULL)
+        right->setParent(node);
+    node->setRed(depth == redDepth);
+    return node;
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last), in
+ * any order, as AVLTree::buildFrom does. threads sorts the items in
+ * parallel; the build itself is one linear pass.
+ */
+template<class Key, class Value, class Arena, class Compare>
+template<typename InputIterator>
+void RedBlackTree<Key, Value, Arena, Compare>::buildFrom(InputIterator first, InputIterator last, unsigned threads)
+{
+    std::vector<std::pair<Key, Value> > items = this->sortedItems(first, last, threads);
+    assignSorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()), threads);
+}
+
+/*
+  ------------------------------------------
+  End implementations for the RedBlackTree class.
+  ------------------------------------------
+*/
+
+#endif
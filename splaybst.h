@@ -0,0 +1,526 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "bst.h"
+
+/**
+* How a SplayTree brings an accessed node to the root.
+*
+* SPLAY_TOP_DOWN splays on the way down (Sleator and Tarjan's top-down
+* splay): the nodes passed over are hung off two side trees as the search
+* goes, so it makes one pass and never walks parent pointers back up.
+*
+* SPLAY_BOTTOM_UP finds the node with an ordinary descent, then rotates
+* it up to the root along its parent pointers.
+*/
+enum SplayMode { SPLAY_TOP_DOWN, SPLAY_BOTTOM_UP };
+
+/**
+* A self-adjusting binary search tree. find, operator[], insert and remove
+* move the key they touch (or, for a missing key, the last node looked at)
+* to the root, so a key that was just used is one step away. Any sequence
+* of operations costs O(log n) amortized each, and a small set of hot keys
+* stays near the top, where lookups cost much less than log n.
+*
+* The nodes are plain Nodes. Rotations keep the in-order links of
+* BST_THREADED builds intact, and removal reuses the BinarySearchTree one.
+* The const lookups of the base class are still there for const trees;
+* they don't splay.
+*/
+template <typename Key, typename Value, typename Arena = HeapArena, typename Compare = std::less<Key> >
+class SplayTree : public BinarySearchTree<Key, Value, Arena, Compare>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Arena, Compare>::iterator iterator;
+
+    explicit SplayTree(SplayMode mode = SPLAY_TOP_DOWN);
+    SplayTree(const Compare& compare, SplayMode mode = SPLAY_TOP_DOWN);
+
+    using BinarySearchTree<Key, Value, Arena, Compare>::insert;
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    virtual iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    virtual void remove(const Key& key);
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    void remove(const K& key);
+
+    using BinarySearchTree<Key, Value, Arena, Compare>::find;
+    using BinarySearchTree<Key, Value, Arena, Compare>::operator[];
+    iterator find(const Key& key);
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    iterator find(const K& key);
+    Value& operator[](const Key& key);
+    template<typename K, typename = typename TransparentKey<Compare, K>::type>
+    Value& operator[](const K& key);
+
+    SplayMode mode() const;
+
+protected:
+    template<typename K>
+    Node<Key, Value>* access(const K& key);
+    template<typename K>
+    int splayTopDown(const K& key);
+    template<typename K>
+    int splayOrder(const K& key, Node<Key, Value>* node, Node<Key, Value>*& bound) const;
+    void splay(Node<Key, Value>* node);
+    void rotateUp(Node<Key, Value>* node);
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual std::pair<iterator, bool> insertCopy(const std::pair<const Key, Value>& keyValuePair);
+    virtual iterator insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename Pair>
+    std::pair<Node<Key, Value>*, bool> insertSplay(Pair&& keyValuePair);
+
+    SplayMode mode_;
+};
+
+/*
+  --------------------------------------------
+  Begin implementations for the SplayTree class.
+  --------------------------------------------
+*/
+
+template<class Key, class Value, class Arena, class Compare>
+SplayTree<Key, Value, Arena, Compare>::SplayTree(SplayMode mode) : mode_(mode)
+{
+
+}
+
+template<class Key, class Value, class Arena, class Compare>
+SplayTree<Key, Value, Arena, Compare>::SplayTree(const Compare& compare, SplayMode mode) :
+    BinarySearchTree<Key, Value, Arena, Compare>(compare),
+    mode_(mode)
+{
+
+}
+
+template<class Key, class Value, class Arena, class Compare>
+SplayMode SplayTree<Key, Value, Arena, Compare>::mode() const
+{
+    return mode_;
+}
+
+/**
+* Inserts or overwrites, then leaves the item at the root.
+*/
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename SplayTree<Key, Value, Arena, Compare>::iterator, bool>
+SplayTree<Key, Value, Arena, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertSplay(std::move(keyValuePair));
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* The hint already says where the item goes, so there is no descent to
+* splay along. The item is linked in next to hint and splayed up from there.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename SplayTree<Key, Value, Arena, Compare>::iterator
+SplayTree<Key, Value, Arena, Compare>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    Node<Key, Value>* node = this->template insertItem<Node<Key, Value> >(hint, std::move(keyValuePair)).first;
+    splay(node);
+    return this->makeIterator(node);
+}
+
+/**
+* The copying inserts, see BinarySearchTree::insertCopy.
+*/
+template<class Key, class Value, class Arena, class Compare>
+std::pair<typename SplayTree<Key, Value, Arena, Compare>::iterator, bool>
+SplayTree<Key, Value, Arena, Compare>::insertCopy(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertSplay(this->copiedItem(keyValuePair));
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+typename SplayTree<Key, Value, Arena, Compare>::iterator
+SplayTree<Key, Value, Arena, Compare>::insertCopy(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* node = this->template insertItem<Node<Key, Value> >(hint, this->copiedItem(keyValuePair)).first;
+    splay(node);
+    return this->makeIterator(node);
+}
+
+/**
+* The key is only known once the item is built, so the base class links
+* it in and it is splayed up from there.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename SplayTree<Key, Value, Arena, Compare>::iterator, bool>
+SplayTree<Key, Value, Arena, Compare>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = this->template emplaceItem<Node<Key, Value> >(std::forward<Args>(args)...);
+    splay(result.first);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename SplayTree<Key, Value, Arena, Compare>::iterator, bool>
+SplayTree<Key, Value, Arena, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = this->template tryEmplaceItem<Node<Key, Value> >(key, std::forward<Args>(args)...);
+    splay(result.first);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename... Args>
+std::pair<typename SplayTree<Key, Value, Arena, Compare>::iterator, bool>
+SplayTree<Key, Value, Arena, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = this->template tryEmplaceItem<Node<Key, Value> >(std::move(key), std::forward<Args>(args)...);
+    splay(result.first);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* Splays key (or its neighbour, if key is missing) to the root, then
+* removes it with the usual swap with the predecessor. The predecessor
+* takes its place at the root.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void SplayTree<Key, Value, Arena, Compare>::remove(const Key& key)
+{
+    Node<Key, Value>* node = access(key);
+    if(node != NULL)
+        removeNode(node);
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+void SplayTree<Key, Value, Arena, Compare>::remove(const K& key)
+{
+    Node<Key, Value>* node = access(key);
+    if(node != NULL)
+        removeNode(node);
+}
+
+/**
+* Returns an iterator to the item with the given key, which is now the
+* root, or end() if there is none.
+*/
+template<class Key, class Value, class Arena, class Compare>
+typename SplayTree<Key, Value, Arena, Compare>::iterator
+SplayTree<Key, Value, Arena, Compare>::find(const Key& key)
+{
+    return this->makeIterator(access(key));
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+typename SplayTree<Key, Value, Arena, Compare>::iterator
+SplayTree<Key, Value, Arena, Compare>::find(const K& key)
+{
+    return this->makeIterator(access(key));
+}
+
+template<class Key, class Value, class Arena, class Compare>
+Value& SplayTree<Key, Value, Arena, Compare>::operator[](const Key& key)
+{
+    Node<Key, Value>* node = access(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+template<class Key, class Value, class Arena, class Compare>
+template<typename K, typename>
+Value& SplayTree<Key, Value, Arena, Compare>::operator[](const K& key)
+{
+    Node<Key, Value>* node = access(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+/**
+* Looks key up and splays, in the tree's mode. Returns the node with key,
+* which is then the root, or NULL, in which case the root is the last
+* node the search looked at.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename K>
+Node<Key, Value>* SplayTree<Key, Value, Arena, Compare>::access(const K& key)
+{
+    if(this->root_ == NULL)
+        return NULL;
+    if(mode_ == SPLAY_TOP_DOWN)
+        return splayTopDown(key) == 0 ? this->root_ : NULL;
+    Node<Key, Value>* parent;
+    bool isLeftChild;
+    Node<Key, Value>* node = this->internalLocate(key, parent, isLeftChild);
+    splay(node != NULL ? node : parent);
+    return node;
+}
+
+/**
+* Top-down splay of a non-empty tree. The search path is cut into the
+* nodes less than key, hung off the right spine of a left tree, and the
+* nodes greater, hung off the left spine of a right tree. Two steps in
+* the same direction rotate first (zig-zig), which is what keeps the
+* amortized bound. Where the search stops, that node becomes the root,
+* with the left and right trees as its subtrees.
+*
+* Returns how key orders against the new root's key: 0 if it was found.
+* One comparator call per node, plus one at the end without a three-way
+* comparator; see splayOrder.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename K>
+int SplayTree<Key, Value, Arena, Compare>::splayTopDown(const K& key)
+{
+    Node<Key, Value> *leftRoot = NULL, *leftMax = NULL;   // Everything less than key
+    Node<Key, Value> *rightRoot = NULL, *rightMin = NULL; // Everything greater
+    Node<Key, Value> *t = this->root_;
+    Node<Key, Value> *bound = NULL;                       // Last node not less than key
+    BST_STAT(STAT_SEARCHES, 1);
+    BST_STAT(STAT_NODES_VISITED, 1);
+    int order = splayOrder(key, t, bound);
+    while(order != 0){
+        Node<Key, Value>* child = order < 0 ? t->getLeft() : t->getRight();
+        if(child == NULL)
+            break;
+        BST_STAT(STAT_NODES_VISITED, 1);
+        int childOrder = splayOrder(key, child, bound);
+        if(childOrder != 0 && (childOrder < 0) == (order < 0)){ // Zig-zig, rotate child above t
+            BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+            if(order < 0){
+                t->setLeft(child->getRight());
+                if(child->getRight() != NULL)
+                    child->getRight()->setParent(t);
+                child->setRight(t);
+            } else {
+                t->setRight(child->getLeft());
+                if(child->getLeft() != NULL)
+                    child->getLeft()->setParent(t);
+                child->setLeft(t);
+            }
+            t->setParent(child);
+            t = child;
+            order = childOrder;
+            child = order < 0 ? t->getLeft() : t->getRight();
+            if(child == NULL)
+                break;
+            BST_STAT(STAT_NODES_VISITED, 1);
+            childOrder = splayOrder(key, child, bound);
+        }
+        // Hang t off the side tree it belongs to, and go on down to child
+        if(order < 0){
+            if(rightMin == NULL)
+                rightRoot = t;
+            else {
+                rightMin->setLeft(t);
+                t->setParent(rightMin);
+            }
+            rightMin = t;
+        } else {
+            if(leftMax == NULL)
+                leftRoot = t;
+            else {
+                leftMax->setRight(t);
+                t->setParent(leftMax);
+            }
+            leftMax = t;
+        }
+        t = child;
+        order = childOrder;
+    }
+
+    // t's own subtrees go to the inner ends of the side trees
+    if(leftMax != NULL){
+        leftMax->setRight(t->getLeft());
+        if(t->getLeft() != NULL)
+            t->getLeft()->setParent(leftMax);
+        t->setLeft(leftRoot);
+        leftRoot->setParent(t);
+    }
+    if(rightMin != NULL){
+        rightMin->setLeft(t->getRight());
+        if(t->getRight() != NULL)
+            t->getRight()->setParent(rightMin);
+        t->setRight(rightRoot);
+        rightRoot->setParent(t);
+    }
+    t->setParent(NULL);
+    this->root_ = t;
+    if(KeyCompare<Compare, Key>::threeWay || bound == NULL || this->compare_.less(key, bound->getKey()))
+        return order;
+    if(bound == t)
+        return 0;
+
+    // bound holds key, but isn't where the path ended. Every node after it on the path was less than key,
+    // so t is its predecessor, with no right child of its own, and bound
+    // is the smallest node of t's right subtree. Lift it above t.
+    BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+    Node<Key, Value>* rest = t->getRight();
+    if(rest == bound)
+        rest = bound->getRight();
+    else {
+        bound->getParent()->setLeft(bound->getRight());
+        if(bound->getRight() != NULL)
+            bound->getRight()->setParent(bound->getParent());
+    }
+    t->setRight(NULL);
+    t->setParent(bound);
+    bound->setLeft(t);
+    bound->setRight(rest);
+    if(rest != NULL)
+        rest->setParent(bound);
+    bound->setParent(NULL);
+    this->root_ = bound;
+    return 0;
+}
+
+/**
+* Which way the top-down splay goes from node. A three-way comparator
+* answers with one order() call. With only less-than, telling "equal"
+* apart from "less" would take a second call at every node, so equal
+* keys go left like lesser ones. bound keeps the last node that went
+* left, the only one that can hold key, and splayTopDown checks it once
+* at the end, as internalLocate does.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename K>
+int SplayTree<Key, Value, Arena, Compare>::splayOrder(const K& key, Node<Key, Value>* node, Node<Key, Value>*& bound) const
+{
+    if(KeyCompare<Compare, Key>::threeWay)
+        return this->compare_.order(key, node->getKey());
+    if(this->compare_.less(node->getKey(), key))
+        return 1;
+    bound = node;
+    return -1;
+}
+
+/**
+* Bottom-up splay: rotates node up to the root along its parent pointers,
+* two levels at a time. A node and parent on the same side of their
+* parents (zig-zig) rotate the parent first; otherwise (zig-zag) the node
+* rotates twice. A lone last step is a single rotation (zig).
+*/
+template<class Key, class Value, class Arena, class Compare>
+void SplayTree<Key, Value, Arena, Compare>::splay(Node<Key, Value>* node)
+{
+    if(node == NULL)
+        return;
+    while(node->getParent() != NULL){
+        Node<Key, Value>* p = node->getParent();
+        Node<Key, Value>* g = p->getParent();
+        if(g == NULL) // Zig
+            rotateUp(node);
+        else if((g->getLeft() == p) == (p->getLeft() == node)){ // Zig-zig
+            rotateUp(p);
+            rotateUp(node);
+        } else { // Zig-zag
+            rotateUp(node);
+            rotateUp(node);
+        }
+    }
+}
+
+/**
+* Rotates node above its parent, updating the root if the parent was it.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void SplayTree<Key, Value, Arena, Compare>::rotateUp(Node<Key, Value>* node)
+{
+    BST_STAT(STAT_SINGLE_ROTATIONS, 1);
+    Node<Key, Value>* p = node->getParent();
+    Node<Key, Value>* g = p->getParent();
+    if(p->getLeft() == node){
+        p->setLeft(node->getRight());
+        if(node->getRight() != NULL)
+            node->getRight()->setParent(p);
+        node->setRight(p);
+    } else {
+        p->setRight(node->getLeft());
+        if(node->getLeft() != NULL)
+            node->getLeft()->setParent(p);
+        node->setLeft(p);
+    }
+    p->setParent(node);
+    node->setParent(g);
+    if(g == NULL)
+        this->root_ = node;
+    else if(g->getLeft() == p)
+        g->setLeft(node);
+    else
+        g->setRight(node);
+}
+
+/**
+* Splays node to the root (a no-op when remove() already has), then
+* unlinks it as BinarySearchTree does.
+*/
+template<class Key, class Value, class Arena, class Compare>
+void SplayTree<Key, Value, Arena, Compare>::removeNode(Node<Key, Value>* node)
+{
+    splay(node);
+    BinarySearchTree<Key, Value, Arena, Compare>::removeNode(node);
+}
+
+/**
+* Insert core. Bottom-up, the item is linked in as a leaf and splayed up.
+* Top-down, the key is splayed first; if it is absent the root is then
+* its neighbour, and the new node goes above it as the new root, taking
+* the root's subtree on its own side.
+*/
+template<class Key, class Value, class Arena, class Compare>
+template<typename Pair>
+std::pair<Node<Key, Value>*, bool> SplayTree<Key, Value, Arena, Compare>::insertSplay(Pair&& keyValuePair)
+{
+    if(mode_ == SPLAY_BOTTOM_UP || this->root_ == NULL){
+        std::pair<Node<Key, Value>*, bool> result = this->template insertItem<Node<Key, Value> >(std::forward<Pair>(keyValuePair));
+        splay(result.first);
+        return result;
+    }
+    int order = splayTopDown(keyValuePair.first);
+    Node<Key, Value>* root = this->root_;
+    if(order == 0){
+        root->setValue(std::forward<Pair>(keyValuePair).second);
+        return std::make_pair(root, false);
+    }
+    Node<Key, Value>* node = this->createNode(static_cast<Node<Key, Value>*>(NULL), std::forward<Pair>(keyValuePair));
+    if(order < 0){ // root and its right subtree are greater
+        node->setLeft(root->getLeft());
+        if(root->getLeft() != NULL)
+            root->getLeft()->setParent(node);
+        root->setLeft(NULL);
+        node->setRight(root);
+    } else {
+        node->setRight(root->getRight());
+        if(root->getRight() != NULL)
+            root->getRight()->setParent(node);
+        root->setRight(NULL);
+        node->setLeft(root);
+    }
+    root->setParent(node);
+    this->root_ = node;
+    if(order > 0 && root == this->largest_)
+        this->largest_ = node;
+#ifdef BST_THREADED
+    // The old root is the new key's neighbour in order
+    Node<Key, Value>* prev = order < 0 ? root->getPrev() : root;
+    Node<Key, Value>* next = order < 0 ? root : root->getNext();
+    this->linkThreads(prev, node);
+    this->linkThreads(node, next);
+#endif
+    return std::make_pair(node, true);
+}
+
+/*
+  ------------------------------------------
+  End implementations for the SplayTree class.
+  ------------------------------------------
+*/
+
+#endif